@@ -0,0 +1,252 @@
+#include <argparse/argparse.hpp>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "simplep2p.hpp"
+
+// Starts several networks inside this process, connects them to each other directly over loopback (or inside a simulation), and measures
+// how many messages (and bytes) per second make it from the publishers to every other node along with the publish to delivery latency.
+
+using clock_type = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+struct Args : public argparse::Args {
+	int& nodes = kwarg("n,nodes", "Number of networks to start").set_default(4);
+	int& publishers = kwarg("p,publishers", "Number of networks which publish messages").set_default(1);
+	double& rate = kwarg("r,rate", "Messages per second each publisher sends (0 sends as fast as possible)").set_default(1000.0);
+	int& size = kwarg("s,size", "Payload size in bytes (at least 16)").set_default(256);
+	double& duration = kwarg("d,duration", "Seconds to measure for").set_default(10.0);
+	double& warmup = kwarg("w,warmup", "Seconds to publish for before measuring").set_default(2.0);
+	double& report = kwarg("report", "Print throughput and memory usage every this many seconds while measuring, 0 disables (useful for soak runs)").set_default(0.0);
+	int& churn = kwarg("churn", "Instead of publishing, time subscribing to, finding, and leaving this many topics").set_default(0);
+	bool& flood = flag("f,flood", "Use floodsub (fullyConnected) instead of gossipsub");
+	bool& zeroCopy = flag("z,zero-copy", "Publish through library owned buffers instead of having every message copied");
+	bool& simulate = flag("m,simulate", "Run the networks inside an in-process simulation instead of on loopback sockets");
+	double& latency = kwarg("latency", "Simulated link latency in milliseconds").set_default(0.0);
+	double& bandwidth = kwarg("bandwidth", "Simulated link bandwidth in bytes per second (0 for unlimited)").set_default(0.0);
+	double& loss = kwarg("loss", "Fraction (0-1) of messages lost crossing a simulated link").set_default(0.0);
+	int& seed = kwarg("seed", "Seed for the simulation's random choices").set_default(0);
+	bool& verbose = flag("v,verbose", "Have the library print debugging information");
+};
+
+// Every payload starts with when it was published, all of the networks share this process's clock so latency can be measured directly
+struct Header {
+	int64_t sent;
+	uint32_t publisher;
+	uint32_t sequence;
+};
+
+int64_t now_ns() { return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count(); }
+
+// Latency histogram with logarithmic buckets (~3% precision), so memory stays flat no matter how long the benchmark runs
+struct Histogram {
+	static constexpr int subBits = 5;
+	static constexpr uint64_t subMask = (1 << subBits) - 1;
+	std::array<std::atomic<uint64_t>, 64 << subBits> counts = {};
+
+	static size_t bucket(uint64_t value) {
+		if(value <= subMask) return value;
+		int shift = 63 - std::countl_zero(value) - subBits;
+		return ((shift + 1) << subBits) + ((value >> shift) & subMask);
+	}
+
+	static uint64_t lower_bound(size_t bucket) {
+		size_t major = bucket >> subBits, minor = bucket & subMask;
+		if(major == 0) return minor;
+		return (subMask + 1 + minor) << (major - 1);
+	}
+
+	void record(uint64_t value) { counts[bucket(value)].fetch_add(1, std::memory_order_relaxed); }
+
+	void merge(const Histogram& o) {
+		for(size_t i = 0; i < counts.size(); i++)
+			counts[i].fetch_add(o.counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
+	uint64_t total() const {
+		uint64_t out = 0;
+		for(auto& count: counts) out += count.load(std::memory_order_relaxed);
+		return out;
+	}
+
+	uint64_t percentile(double p) const {
+		uint64_t target = std::ceil(p * total()), seen = 0;
+		for(size_t i = 0; i < counts.size(); i++)
+			if((seen += counts[i].load(std::memory_order_relaxed)) >= target && seen > 0)
+				return lower_bound(i);
+		return 0;
+	}
+};
+
+std::atomic<bool> measuring = false;
+
+struct Node {
+	std::unique_ptr<p2p::Network> net = std::make_unique<p2p::Network>(p2p::do_not_initialize);
+	std::atomic<uint64_t> messages = 0, bytes = 0;
+	Histogram latency; // Nanoseconds from publish to delivery
+
+	void record(p2p::Message& message) {
+		if(message.is_local() || !measuring.load(std::memory_order_relaxed)) return;
+		auto data = message.data();
+		if(data.size() < sizeof(Header)) return;
+
+		Header header;
+		std::memcpy(&header, data.data(), sizeof(header));
+		latency.record(now_ns() - header.sent);
+		messages.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(data.size(), std::memory_order_relaxed);
+	}
+};
+
+// The resident set size of the process in MiB (0 where it can't be determined)
+double rss_mib() {
+#ifdef __linux__
+	std::ifstream status("/proc/self/status");
+	for(std::string line; std::getline(status, line); )
+		if(line.rfind("VmRSS:", 0) == 0)
+			return std::stod(line.substr(6)) / 1024; // Reported in KiB
+#endif
+	return 0;
+}
+
+double seconds(clock_type::duration d) { return std::chrono::duration<double>(d).count(); }
+
+// Times subscribing to, finding, and leaving many short lived topics
+int churn(p2p::Network& net, int count) {
+	auto start = clock_type::now();
+	for(int i = 0; i < count; i++) {
+		auto name = "simplep2p/bench/churn/" + std::to_string(i);
+		auto topic = net.subscribe_to_topic(name);
+		if(!topic || net.find_topic(name).id != topic.id || !topic.leave()) {
+			std::cerr << "Topic churn failed at topic " << i << std::endl;
+			return 1;
+		}
+	}
+	auto elapsed = seconds(clock_type::now() - start);
+	std::cout << "churned " << count << " topics in " << elapsed << " s (" << count / elapsed << " subscribe/find/leave cycles/s), rss " << rss_mib() << " MiB" << std::endl;
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	Args args = argparse::parse<Args>(argc, argv);
+	args.nodes = std::max(args.nodes, 1);
+	args.publishers = std::clamp(args.publishers, 1, args.nodes);
+	args.size = std::max<int>(args.size, sizeof(Header));
+
+	std::optional<p2p::Simulation> simulation; // Declared before the nodes so that it outlives them
+	if(args.simulate)
+		simulation.emplace(p2p::LinkOptions{std::chrono::microseconds((long long)(args.latency * 1000)), args.bandwidth, args.loss}, args.seed);
+
+	std::vector<std::unique_ptr<Node>> nodes;
+	for(int i = 0; i < args.nodes; i++) {
+		auto& node = nodes.emplace_back(std::make_unique<Node>());
+		node->net->on_message = [node = node.get()](p2p::Network&, p2p::Message& message) { node->record(message); };
+		node->net->initialize("/ip4/127.0.0.1/udp/0/quic-v1", "simplep2p/bench/v1.0.0", {}, 60s, args.flood, args.verbose,
+			simulation ? simulation->discovery(args.nodes - 1) : p2p::DiscoveryOptions::local());
+	}
+
+	if(args.churn > 0)
+		return churn(*nodes.front()->net, args.churn);
+
+	// Connect every pair of nodes directly and wait for them all to see each other in the benchmark topic
+	for(size_t i = 1; i < nodes.size(); i++)
+		for(size_t j = 0; j < i; j++)
+			for(auto& address: nodes[j]->net->listen_addresses())
+				if(nodes[i]->net->connect(address)) break;
+
+	auto deadline = clock_type::now() + 30s;
+	for(auto& node: nodes)
+		while(node->net->peers().size() + 1 < nodes.size() && clock_type::now() < deadline)
+			std::this_thread::sleep_for(50ms);
+	for(auto& node: nodes)
+		if(node->net->peers().size() + 1 < nodes.size())
+			std::cerr << "Warning: a node only sees " << node->net->peers().size() << " of its " << nodes.size() - 1 << " peers" << std::endl;
+
+	std::atomic<bool> running = true;
+	std::atomic<uint64_t> published = 0, failed = 0;
+	std::vector<std::thread> publishers;
+	for(int p = 0; p < args.publishers; p++)
+		publishers.emplace_back([&, p] {
+			auto& net = *nodes[p]->net;
+			std::vector<std::byte> payload(args.size);
+			auto period = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(args.rate > 0 ? 1 / args.rate : 0));
+			auto next = clock_type::now();
+
+			for(uint32_t sequence = 0; running.load(std::memory_order_relaxed); sequence++) {
+				if(args.rate > 0) std::this_thread::sleep_until(next += period);
+
+				bool success;
+				if(args.zeroCopy) {
+					p2p::Buffer buffer(args.size);
+					Header header = {now_ns(), (uint32_t)p, sequence};
+					std::memcpy(buffer.data().data(), &header, sizeof(header));
+					success = net.broadcast_buffer(std::move(buffer));
+				} else {
+					Header header = {now_ns(), (uint32_t)p, sequence};
+					std::memcpy(payload.data(), &header, sizeof(header));
+					success = net.broadcast_message(std::span<const std::byte>{payload});
+				}
+
+				if(measuring.load(std::memory_order_relaxed))
+					(success ? published : failed).fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(args.warmup));
+	measuring = true;
+	auto start = clock_type::now(), end = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(args.duration));
+	uint64_t lastDelivered = 0;
+	auto lastReport = start;
+	while(clock_type::now() < end) {
+		if(args.report <= 0) {
+			std::this_thread::sleep_until(end);
+			break;
+		}
+
+		std::this_thread::sleep_until(std::min(end, lastReport + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(args.report))));
+		uint64_t delivered = 0;
+		for(auto& node: nodes) delivered += node->messages.load(std::memory_order_relaxed);
+		auto now = clock_type::now();
+		std::cout << std::fixed << std::setprecision(1) << "[" << seconds(now - start) << " s] " << delivered << " delivered ("
+			<< (delivered - lastDelivered) / seconds(now - lastReport) << " msg/s), rss " << rss_mib() << " MiB" << std::endl;
+		lastDelivered = delivered;
+		lastReport = now;
+	}
+	measuring = false;
+	auto elapsed = seconds(clock_type::now() - start);
+	running = false;
+	for(auto& publisher: publishers) publisher.join();
+
+	uint64_t messages = 0, bytes = 0, callbacks = 0;
+	double callbackTime = 0;
+	Histogram latency;
+	for(auto& node: nodes) {
+		messages += node->messages;
+		bytes += node->bytes;
+		latency.merge(node->latency);
+		auto stats = node->net->stats();
+		callbacks += stats.callbacks;
+		callbackTime += stats.callback_time;
+	}
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< args.nodes << (args.simulate ? " simulated" : "") << " nodes (" << (args.flood ? "floodsub" : "gossipsub") << "), " << args.publishers << " publishers, " << args.size << " byte payloads, "
+		<< (args.rate > 0 ? std::to_string((int)args.rate) + " msg/s each" : std::string("unthrottled")) << ", " << (args.zeroCopy ? "zero copy" : "copying") << " publish\n"
+		<< "published: " << published << " messages (" << published / elapsed << " msg/s), " << failed << " failed\n"
+		<< "delivered: " << messages << " messages (" << messages / elapsed << " msg/s, " << bytes / elapsed / (1024 * 1024) << " MiB/s), "
+		<< (published ? 100.0 * messages / (published * (args.nodes - 1)) : 0.0) << "% of expected\n"
+		<< "latency:   p50 " << latency.percentile(0.5) / 1000.0 << " us, p99 " << latency.percentile(0.99) / 1000.0 << " us, p999 " << latency.percentile(0.999) / 1000.0 << " us\n"
+		<< "callbacks: " << callbacks << " calls, " << callbackTime << " s inside them (all nodes, including warmup)\n"
+		<< "rss:       " << rss_mib() << " MiB" << std::endl;
+	return 0;
+}
@@ -9,39 +9,39 @@ using namespace p2p; // We are using the C++ wrapper's utilities for saving and
 // the C++ wrapper puts all of the the C wrapper code into the p2p namespace so we use it to pretend we are just using the C api...
 
 
-bool print(P2PNetwork network, P2PMessage* message) {
-	if(std::string_view(message->received_from) == std::string_view(p2p_local_id(network)))
+bool print(P2PNetwork network, P2PMessage* message, void*) {
+	if(message->local)
 		// std::cout << "from us";
 		return true;
 
 	// Green console colour: 	\x1b[32m
 	// Reset console colour: 	\x1b[0m
-	std::cout << "\x1b[32m" << message->received_from << ": " << message->data << "\n\x1b[0m> " << std::flush;
+	std::cout << "\x1b[32m" << std::string_view(message->received_from, message->received_from_size) << ": " << std::string_view(message->data, message->data_size) << "\n\x1b[0m> " << std::flush;
 	return true;
 }
 
 
-bool peerJoined(P2PNetwork network, char* id) {
+bool peerJoined(P2PNetwork network, char* id, P2PPeer, void*) {
 	std::cout << id << " connected!" << std::endl;
 	return true;
 }
 
-bool peerLeft(P2PNetwork network, char* id) {
+bool peerLeft(P2PNetwork network, char* id, P2PPeer, void*) {
 	std::cout << id << " disconnected!" << std::endl;
 	return true;
 }
 
-bool topicSubscribed(P2PNetwork network, int topic) {
+bool topicSubscribed(P2PNetwork network, int topic, void*) {
 	std::cout << "subscribed to topic " << topic << std::endl;
 	return true;
 }
 
-bool topicUnsubscribed(P2PNetwork network, int topic) {
+bool topicUnsubscribed(P2PNetwork network, int topic, void*) {
 	std::cout << "unsubscribed to topic " << topic << std::endl;
 	return true;
 }
 
-bool connected(P2PNetwork network) {
+bool connected(P2PNetwork network, void*) {
 	std::cout << "connected to the network!\n> " << std::flush;
 	return true;
 }
@@ -70,15 +70,15 @@ int main(int argc, char* argv[]) {
 	std::cout << p2p_base64_encoden("hello world\0this is a second part of the message", 48).data << std::endl;
 	std::cout << p2p_base64_decode("aGVsbG8gd29ybGQAdGhpcyBpcyBhIHNlY29uZCBwYXJ0IG9mIHRoZSBtZXNzYWdl").data[41] << std::endl;
 
-	p2p_set_peer_connected_callback(p2p_initial_network(), peerJoined); // NOTE: these callbacks will only be called for peers directly connected... if you need to know about all peers in the network that will need to be done at a higher level!
-	p2p_set_peer_disconnected_callback(p2p_initial_network(), peerLeft); // NOTE: these callbacks will only be called for peers directly connected... if you need to know about all peers in the network that will need to be done at a higher level!
+	p2p_set_peer_connected_callback(p2p_initial_network(), peerJoined, nullptr); // NOTE: these callbacks will only be called for peers directly connected... if you need to know about all peers in the network that will need to be done at a higher level!
+	p2p_set_peer_disconnected_callback(p2p_initial_network(), peerLeft, nullptr); // NOTE: these callbacks will only be called for peers directly connected... if you need to know about all peers in the network that will need to be done at a higher level!
 
 	auto network = p2p_initialize(p2p_initialize_args_from_strings("/ip4/0.0.0.0/udp/0/quic-v1", "simplep2p/examples/chat/capi/v1.0.0", key, 60, false, false));
 
-	p2p_set_message_callback(network, print);
-	p2p_set_connected_callback(network, connected);
-	p2p_set_topic_subscribed_callback(network, topicSubscribed);
-	p2p_set_topic_unsubscribed_callback(network, topicUnsubscribed);
+	p2p_set_message_callback(network, print, nullptr);
+	p2p_set_connected_callback(network, connected, nullptr);
+	p2p_set_topic_subscribed_callback(network, topicSubscribed, nullptr);
+	p2p_set_topic_unsubscribed_callback(network, topicUnsubscribed, nullptr);
 
 	std::string line;
 	while(true){
@@ -18,11 +18,11 @@ void print(p2p::Network& network, p2p::Message& message) {
 }
 
 
-void peerJoined(p2p::Network& network, p2p::PeerID::view id) {
+void peerJoined(p2p::Network& network, p2p::PeerID::view id, p2p::P2PPeer) {
 	std::cout << id << " connected!" << std::endl;
 }
 
-void peerLeft(p2p::Network& network, p2p::PeerID::view id) {
+void peerLeft(p2p::Network& network, p2p::PeerID::view id, p2p::P2PPeer) {
 	std::cout << id << " disconnected!" << std::endl;
 }
 
@@ -43,6 +43,8 @@ void connected(p2p::Network& network) {
 
 struct Args : public argparse::Args {
 	std::string& keyFile = kwarg("k,keyfile", "File path to the key identity").set_default("id.key");
+	std::string& bootstrap = kwarg("b,bootstrap", "Multiaddr of a peer to connect to directly").set_default("");
+	bool& local = flag("l,local", "Only look for peers on the local network (no internet access needed)");
 };
 
 int main(int argc, char* argv[]) {
@@ -63,7 +65,11 @@ int main(int argc, char* argv[]) {
 	std::cout << p2p::base64_encode({"hello world\0this is a second part of the message", 48}) << std::endl;
 	std::cout << p2p::base64_decode("aGVsbG8gd29ybGQAdGhpcyBpcyBhIHNlY29uZCBwYXJ0IG9mIHRoZSBtZXNzYWdl")[41] << std::endl;
 
-	p2p::Network net(p2p::default_listen_address, "simplep2p/examples/chat/v1.0.0", key, connected);
+	p2p::DiscoveryOptions discovery;
+	if(args.local) discovery = p2p::DiscoveryOptions::local();
+	if(!args.bootstrap.empty()) discovery.bootstrapPeers.push_back(args.bootstrap);
+
+	p2p::Network net(p2p::default_listen_address, "simplep2p/examples/chat/v1.0.0", key, connected, std::chrono::seconds(60), false, false, discovery);
 
 	net.on_message = print;
 
@@ -72,6 +78,9 @@ int main(int argc, char* argv[]) {
 
 	net.on_topic_subscribed = topicSubscribed;
 	net.on_topic_unsubscribed = topicUnsubscribed;
+	net.on_error = [](p2p::Network&, p2p::P2PError, std::string_view description) {
+		std::cerr << "\x1b[31m" << description << "\n\x1b[0m> " << std::flush;
+	};
 
 	std::string line;
 	while(true){
@@ -7,35 +7,138 @@ package main
 typedef struct {
 	int network;
 	char* from;
+	int from_size;
 	char* data;
+	int data_size;
 	char* seqno;
+	int seqno_size;
 	char* topic;
+	int topic_size;
 	char* signature;
+	int signature_size;
 	char* key;
+	int key_size;
 	char* id;
+	int id_size;
 	char* recieved_from;
+	int recieved_from_size;
+	bool local;
+	int recieved_from_handle;
 } Message;
-typedef bool (*msg_callback)(int, Message*);
-extern bool bridge_msg_callback(int n, Message* m, msg_callback f);
-typedef bool (*void_callback)(int);
-extern bool bridge_void_callback(int n, void_callback f);
-typedef bool (*peer_callback)(int, char*);
-extern bool bridge_peer_callback(int n, char* p, peer_callback f);
-typedef bool (*topic_callback)(int, int);
-extern bool bridge_topic_callback(int n, int t, topic_callback f);
+typedef struct {
+	const char* data;
+	int size;
+	int topic;
+} OutMessage;
+
+typedef bool (*msg_callback)(int, Message*, void*);
+typedef bool (*msg_batch_callback)(int, Message*, int, void*);
+extern bool bridge_msg_batch_callback(int n, Message* m, int count, msg_batch_callback batch, void* batchUserData, msg_callback f, void* userData);
+extern int bridge_queue_messages(void* state, Message* m, int count);
+
+typedef bool (*publish_callback)(int, bool, void*);
+extern bool bridge_publish_callback(int n, bool success, publish_callback f, void* userData);
+enum { PUBLISH_QUEUED, PUBLISH_BACKPRESSURE, PUBLISH_FAILED };
+
+enum { DISCOVERY_DHT, DISCOVERY_LOCAL, DISCOVERY_ALL };
+typedef struct {
+	double time_to_first_peer;
+	double time_to_target_peers;
+	int connected_peers;
+	int target_peers;
+	int rounds;
+} DiscoveryMetrics;
+
+typedef struct {
+	unsigned long long messages_published;
+	unsigned long long bytes_published;
+	unsigned long long publish_errors;
+	unsigned long long messages_received;
+	unsigned long long bytes_received;
+	int buffered_messages;
+	int peers;
+} TopicStats;
+typedef struct {
+	TopicStats totals;
+	int topics;
+	int connected_peers;
+	unsigned long long callbacks;
+	double callback_time;
+	unsigned long long peer_connected_events;
+	unsigned long long peer_disconnected_events;
+	unsigned long long dials;
+	unsigned long long failed_dials;
+	unsigned long long errors;
+	int publish_queue_depth;
+	int queued_messages;
+	unsigned long long dropped_messages;
+} Stats;
+enum { CALLBACK_MESSAGE, CALLBACK_PUBLISH, CALLBACK_PEER, CALLBACK_TOPIC, CALLBACK_NETWORK, CALLBACK_ERROR, CALLBACK_KIND_COUNT };
+typedef struct {
+	unsigned long long calls[CALLBACK_KIND_COUNT];
+	double total_time[CALLBACK_KIND_COUNT];
+	double callback_time[CALLBACK_KIND_COUNT];
+} CallbackProfile;
+typedef struct {
+	unsigned long long count;
+	double min;
+	double mean;
+	double p50;
+	double p90;
+	double p99;
+	double p999;
+	double max;
+} LatencyStats;
+
+enum { EVENT_PEER_CONNECTED, EVENT_PEER_DISCONNECTED, EVENT_TOPIC_SUBSCRIBED, EVENT_TOPIC_UNSUBSCRIBED, EVENT_CONNECTED, EVENT_DISCONNECTED, EVENT_ERROR };
+enum { ERROR_NONE, ERROR_DISCOVERY_TIMEOUT, ERROR_DISCOVERY };
+extern bool bridge_queue_event(void* state, int n, int type, int topic, int peer, int error, _GoString_ detail);
+typedef bool (*void_callback)(int, void*);
+extern bool bridge_void_callback(int n, void_callback f, void* userData);
+typedef bool (*peer_callback)(int, char*, int, void*);
+extern bool bridge_peer_callback(int n, char* p, int h, peer_callback f, void* userData);
+typedef bool (*topic_callback)(int, int, void*);
+extern bool bridge_topic_callback(int n, int t, topic_callback f, void* userData);
+typedef bool (*error_callback)(int, int, char*, void*);
+extern bool bridge_error_callback(int n, int e, char* m, error_callback f, void* userData);
+
+enum { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR, LOG_OFF };
+typedef struct {
+	int level;
+	int network;
+	double time;
+	unsigned int repeated;
+	char* message;
+	int message_size;
+} LogRecord;
+typedef void (*log_callback)(LogRecord*, int, void*);
+extern void bridge_log_callback(LogRecord* records, int count, log_callback f, void* userData);
 */
 import "C"
 import (
 	"context"
 	"crypto/rand"
+	"crypto/sha256"
 	b64 "encoding/base64"
+	"encoding/binary"
+	"encoding/hex"
 	"fmt"
+	"math"
+	"math/bits"
+	mrand "math/rand"
+	"os"
+	"runtime"
+	"runtime/pprof"
+	"sort"
+	"strings"
 	"sync"
+	"sync/atomic"
 	"time"
 	"unsafe"
 
 	"github.com/libp2p/go-libp2p"
 	"github.com/libp2p/go-libp2p/core/crypto"
+	"github.com/libp2p/go-libp2p/core/network"
 	"github.com/libp2p/go-libp2p/core/peer"
 
 	dht "github.com/libp2p/go-libp2p-kad-dht"
@@ -43,468 +146,2973 @@ import (
 	pubsub "github.com/libp2p/go-libp2p-pubsub"
 	"github.com/libp2p/go-libp2p/core/host"
 
+	"github.com/libp2p/go-libp2p/p2p/discovery/mdns"
 	drouting "github.com/libp2p/go-libp2p/p2p/discovery/routing"
 
 	dutil "github.com/libp2p/go-libp2p/p2p/discovery/util"
+	mocknet "github.com/libp2p/go-libp2p/p2p/net/mock"
+	ma "github.com/multiformats/go-multiaddr"
 )
 
-var messageCallbacks = make(map[int]C.msg_callback)
+// userCallback pairs a C function with the (C owned) user data which is passed back to it every time it is invoked
+type userCallback[F any] struct {
+	f        F
+	userData unsafe.Pointer
+}
+
+// callbacks holds the C functions a network passes its messages and events to
+type callbacks struct {
+	message           userCallback[C.msg_callback]
+	messageBatch      userCallback[C.msg_batch_callback]
+	peerConnected     userCallback[C.peer_callback]
+	peerDisconnected  userCallback[C.peer_callback]
+	topicSubscribed   userCallback[C.topic_callback]
+	topicUnsubscribed userCallback[C.topic_callback]
+	connected         userCallback[C.void_callback]
+	disconnected      userCallback[C.void_callback]
+	error             userCallback[C.error_callback]
+}
 
 //export setMessageCallback
-func setMessageCallback(nid int, callback C.msg_callback) {
-	messageCallbacks[nid] = callback
+func setMessageCallback(nid int, callback C.msg_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.message = userCallback[C.msg_callback]{callback, userData} })
 }
 
-var peerconnectedCallbacks = make(map[int]C.peer_callback)
+//export setMessageBatchCallback
+func setMessageBatchCallback(nid int, callback C.msg_batch_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.messageBatch = userCallback[C.msg_batch_callback]{callback, userData} })
+}
 
-//export setPeerConnectedCallback
-func setPeerConnectedCallback(nid int, callback C.peer_callback) {
-	peerconnectedCallbacks[nid] = callback
+// batchLimits controls how many messages a reciever will try to group together before handing them to C
+type batchLimits struct {
+	count   int           // The maximum number of messages in a batch
+	latency time.Duration // How long to wait for more messages once the already buffered ones have been drained
 }
 
-var peerDisconnectedCallbacks = make(map[int]C.peer_callback)
+// defaultBatchLimits only groups messages which have already arrived, it never delays a message waiting for more
+var defaultBatchLimits = batchLimits{count: 64, latency: 0}
 
-//export setPeerDisconnectedCallback
-func setPeerDisconnectedCallback(nid int, callback C.peer_callback) {
-	peerDisconnectedCallbacks[nid] = callback
+//export setMessageBatchLimits
+func setMessageBatchLimits(nid int, maxCount int, maxLatency float64) {
+	if maxCount < 1 {
+		maxCount = 1
+	}
+	limits := batchLimits{count: maxCount, latency: time.Duration(maxLatency * float64(time.Second))}
+	states.configure(nid, func(s *State) { s.batchLimits = limits })
 }
 
-var topicSubscribedCallbacks = make(map[int]C.topic_callback)
+// pollState points to the C owned queues of a network whose messages and/or events are polled instead of being passed to callbacks
+type pollState struct {
+	state    unsafe.Pointer
+	messages bool // Are messages being queued?
+	events   bool // Are peer, topic, and connection events being queued?
+}
 
-//export setTopicSubscribedCallback
-func setTopicSubscribedCallback(nid int, callback C.topic_callback) {
-	topicSubscribedCallbacks[nid] = callback
+// installPollState gives a network its C owned poll state, unless another thread already gave it one (which is returned instead)
+// Returns nil if the network has been (or is being) shutdown, the caller then still owns the state
+//
+//export installPollState
+func installPollState(nid int, state unsafe.Pointer) unsafe.Pointer {
+	s := states.reserve(nid)
+	if s == nil {
+		return nil
+	}
+	s.Lock()
+	defer s.Unlock()
+	if s.closed {
+		return nil
+	}
+	if s.poll.state == nil {
+		s.poll.state = state
+	}
+	return s.poll.state
 }
 
-var topicUnsubscribedCallbacks = make(map[int]C.topic_callback)
+// enablePollQueue starts pushing a network's messages or events into the matching queue of its poll state
+//
+//export enablePollQueue
+func enablePollQueue(nid int, events bool) bool {
+	enabled := false
+	states.configure(nid, func(s *State) {
+		if s.closed || s.poll.state == nil {
+			return
+		}
+		if events {
+			s.poll.events = true
+		} else {
+			s.poll.messages = true
+		}
+		enabled = true
+	})
+	return enabled
+}
 
-//export setTopicUnsubscribedCallback
-func setTopicUnsubscribedCallback(nid int, callback C.topic_callback) {
-	topicUnsubscribedCallbacks[nid] = callback
+// getPollState looks up a running network's poll state, for networks C doesn't have cached
+//
+//export getPollState
+func getPollState(nid int) unsafe.Pointer {
+	if s := states.get(nid); s != nil {
+		return s.getPoll().state
+	}
+	return nil
 }
 
-var connectedCallbacks = make(map[int]C.void_callback)
+//export setPeerConnectedCallback
+func setPeerConnectedCallback(nid int, callback C.peer_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.peerConnected = userCallback[C.peer_callback]{callback, userData} })
+}
 
-//export setConnectedCallback
-func setConnectedCallback(nid int, callback C.void_callback) {
-	connectedCallbacks[nid] = callback
+//export setPeerDisconnectedCallback
+func setPeerDisconnectedCallback(nid int, callback C.peer_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.peerDisconnected = userCallback[C.peer_callback]{callback, userData} })
 }
 
-var disconnectedCallbacks = make(map[int]C.void_callback)
+//export setTopicSubscribedCallback
+func setTopicSubscribedCallback(nid int, callback C.topic_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.topicSubscribed = userCallback[C.topic_callback]{callback, userData} })
+}
 
-//export setDisconnectedCallback
-func setDisconnectedCallback(nid int, callback C.void_callback) {
-	disconnectedCallbacks[nid] = callback
+//export setTopicUnsubscribedCallback
+func setTopicUnsubscribedCallback(nid int, callback C.topic_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.topicUnsubscribed = userCallback[C.topic_callback]{callback, userData} })
 }
 
-/*
+//export setConnectedCallback
+func setConnectedCallback(nid int, callback C.void_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.connected = userCallback[C.void_callback]{callback, userData} })
+}
 
+//export setDisconnectedCallback
+func setDisconnectedCallback(nid int, callback C.void_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.disconnected = userCallback[C.void_callback]{callback, userData} })
+}
 
+//export setErrorCallback
+func setErrorCallback(nid int, callback C.error_callback, userData unsafe.Pointer) {
+	states.configure(nid, func(s *State) { s.callbacks.error = userCallback[C.error_callback]{callback, userData} })
+}
 
- */
+// queueEvent pushes an event into the network's event queue, waiting for space to become available if the queue blocks when full
+// detail is the peer ID for peer events and the description for errors
+// Returns false if the network's events aren't being queued
+func queueEvent(s *State, event C.int, topicID int, peerHandle int, errorCode C.int, detail string) bool {
+	for {
+		// The lock is held while pushing so shutdown can't free the queue out from under us
+		s.RLock()
+		if s.closed && s.poll.state == nil {
+			s.RUnlock()
+			return true // Shutdown has already freed the queue, so the event is dropped
+		}
+		if !s.poll.events {
+			s.RUnlock()
+			return false
+		}
+		queued := C.bridge_queue_event(s.poll.state, C.int(s.id), event, C.int(topicID), C.int(peerHandle), errorCode, detail)
+		s.RUnlock()
 
-// Topic represents a pubsub topic
-type Topic struct {
-	name         string
-	topic        *pubsub.Topic
-	subscription *pubsub.Subscription
+		if queued || s.ctx.Err() != nil { // When shutting down nobody will drain the queue anymore
+			return true
+		}
+		time.Sleep(queueRetryInterval)
+	}
 }
 
-// State represents the State of a network connection
-type State struct {
-	verbose           bool
-	connectionTimeout float64
-	ctx               context.Context
-	cancel            context.CancelFunc
-	host              host.Host
-	dht               *dht.IpfsDHT
-	ps                *pubsub.PubSub
-	topics            map[int]Topic // Maps a topicID to the above topic struct
+// notifyPeer tells C that a peer has connected or disconnected, either by queuing an event or invoking the callback
+func notifyPeer(s *State, event C.int, peerID peer.ID, callback userCallback[C.peer_callback]) bool {
+	if event == C.EVENT_PEER_CONNECTED {
+		s.stats.peerConnectedEvents.Add(1)
+	} else {
+		s.stats.peerDisconnectedEvents.Add(1)
+	}
+	handle := s.handles.intern(peerID)
+	if queueEvent(s, event, -1, handle, C.ERROR_NONE, string(peerID)) {
+		return true
+	}
+
+	c := C.CString(string(peerID))
+	defer C.free(unsafe.Pointer(c))
+	if callback.f != nil { // Only calls which reach the application are profiled
+		defer s.stats.timeCallback(C.CALLBACK_PEER, time.Now())
+	}
+	return bool(C.bridge_peer_callback(C.int(s.id), c, C.int(handle), callback.f, callback.userData))
 }
 
-var states = make(map[int]State)
+// notifyTopic tells C that a topic has been subscribed to or unsubscribed from, either by queuing an event or invoking the callback
+func notifyTopic(s *State, event C.int, topicID int, callback userCallback[C.topic_callback]) bool {
+	if queueEvent(s, event, topicID, -1, C.ERROR_NONE, "") {
+		return true
+	}
+	if callback.f != nil { // Only calls which reach the application are profiled
+		defer s.stats.timeCallback(C.CALLBACK_TOPIC, time.Now())
+	}
+	return bool(C.bridge_topic_callback(C.int(s.id), C.int(topicID), callback.f, callback.userData))
+}
 
-//export networksCount
-func networksCount() C.int {
-	return C.int(len(states))
+// notifyNetwork tells C that the network has connected or disconnected, either by queuing an event or invoking the callback
+func notifyNetwork(s *State, event C.int, callback userCallback[C.void_callback]) bool {
+	if queueEvent(s, event, -1, -1, C.ERROR_NONE, "") {
+		return true
+	}
+	return callNetwork(s, callback)
 }
 
-//export networkValid
-func networkValid(nid int) bool {
-	_, ok := states[nid]
-	return ok
+// callNetwork invokes a connected or disconnected callback
+func callNetwork(s *State, callback userCallback[C.void_callback]) bool {
+	if callback.f != nil { // Only calls which reach the application are profiled
+		defer s.stats.timeCallback(C.CALLBACK_NETWORK, time.Now())
+	}
+	return bool(C.bridge_void_callback(C.int(s.id), callback.f, callback.userData))
 }
 
-//export base64Encode
-func base64Encode(str *C.char, size C.int) (*C.char, C.int) {
-	encoded := b64.URLEncoding.EncodeToString(C.GoBytes(unsafe.Pointer(str), size))
-	return C.CString(encoded), C.int(len(encoded))
+// noLogSink is the log sink's level while no log callback is set, messages then go to stdout (everything when verbose, otherwise only errors)
+const noLogSink = -1
+
+// logRingSize is how many log records can be staged for the log callback before new ones are dropped (must be a power of two)
+const logRingSize = 1024
+
+// logBatchSize is the most log records handed to the log callback at once
+const logBatchSize = 64
+
+// logRepeatWindow is how long identical log messages are suppressed for after one has been delivered
+const logRepeatWindow = time.Second
+
+// maxTrackedLogMessages bounds how many distinct messages are being suppressed at once (anything beyond is delivered without limiting)
+const maxTrackedLogMessages = 256
+
+// logRecord is a formatted log message waiting to be delivered to the log callback
+type logRecord struct {
+	level    C.int
+	network  int // -1 for messages which aren't about a particular network
+	time     time.Time
+	repeated uint32 // How many identical messages were suppressed since this one was last delivered
+	message  string
 }
 
-//export base64Decode
-func base64Decode(encoded string) (*C.char, C.int) {
-	decoded, ok := b64.URLEncoding.DecodeString(encoded)
-	if ok != nil {
-		return nil, -1
+// logRing is a bounded lock-free multi-producer single-consumer ring staging log records for the log sink's delivery goroutine
+type logRing struct {
+	cells [logRingSize]struct {
+		sequence atomic.Uint64
+		record   logRecord
 	}
-	return (*C.char)(C.CBytes(decoded)), C.int(len(decoded))
+	enqueuePos atomic.Uint64
+	dequeuePos uint64 // Only touched by the delivery goroutine
+	dropped    atomic.Uint64
 }
 
-// generateCKey exports a cryptographic key to C
-//
-//export generateCKey
-func generateCKey() (*C.char, C.int) {
-	str := string(generateKey())
-	return C.CString(str), C.int(len(str))
+// push stages a record, returning false (and counting it as dropped) if the ring is full
+func (r *logRing) push(record logRecord) bool {
+	pos := r.enqueuePos.Load()
+	for {
+		cell := &r.cells[pos&(logRingSize-1)]
+		switch diff := int64(cell.sequence.Load() - pos); {
+		case diff == 0:
+			if r.enqueuePos.CompareAndSwap(pos, pos+1) {
+				cell.record = record
+				cell.sequence.Store(pos + 1)
+				return true
+			}
+			pos = r.enqueuePos.Load()
+		case diff < 0:
+			r.dropped.Add(1)
+			return false
+		default:
+			pos = r.enqueuePos.Load()
+		}
+	}
 }
 
-// generateKey generates a new cryptographic key
-func generateKey() []byte {
-	privKey, _, err := crypto.GenerateECDSAKeyPair(rand.Reader)
-	if err != nil {
-		panic(err)
+// pop removes the oldest staged record (only called by the delivery goroutine)
+func (r *logRing) pop() (logRecord, bool) {
+	cell := &r.cells[r.dequeuePos&(logRingSize-1)]
+	if cell.sequence.Load() != r.dequeuePos+1 {
+		return logRecord{}, false
 	}
+	record := cell.record
+	cell.record = logRecord{}
+	cell.sequence.Store(r.dequeuePos + logRingSize)
+	r.dequeuePos++
+	return record, true
+}
 
-	keyBytes, err := crypto.MarshalPrivateKey(privKey)
-	if err != nil {
-		panic(err)
-	}
+// logRepeatKey identifies identical log messages
+type logRepeatKey struct {
+	level   C.int
+	network int
+	message string
+}
 
-	return keyBytes
+// logRepeat tracks the suppression window of a log message which was recently delivered
+type logRepeat struct {
+	until      time.Time
+	suppressed uint32
 }
 
-// initialize starts up a connection to the p2p network and initializes some library states
-//
-//export initialize
-func initialize(listenAddress string, discoveryTopic string, keyString string, connectionTimeout float64, fullyConnected bool, verbose bool) int {
-	var nid = len(states)
-	var localState State
-	localState.verbose = verbose
-	localState.connectionTimeout = connectionTimeout
+// logger delivers log records to the application's log callback, it is shared by every network in the process
+type logger struct {
+	level    atomic.Int32 // The lowest level delivered to the callback (or noLogSink)
+	callback atomic.Pointer[userCallback[C.log_callback]]
+	ring     logRing
+	started  atomic.Bool
+	start    sync.Once
+	wake     chan struct{}      // Tells the delivery goroutine records have been staged
+	flush    chan chan struct{} // Asks the delivery goroutine to deliver everything staged so far (closing the channel once done)
+}
 
-	ctx, cancel := context.WithCancel(context.Background())
-	localState.ctx = ctx
-	localState.cancel = cancel
+// newLogger creates a logger without a callback
+func newLogger() *logger {
+	l := &logger{wake: make(chan struct{}, 1), flush: make(chan chan struct{})}
+	l.level.Store(noLogSink)
+	for i := range l.ring.cells {
+		l.ring.cells[i].sequence.Store(uint64(i))
+	}
+	return l
+}
 
-	key := []byte(keyString)
-	if len(key) <= 0 {
-		key = generateKey()
+// logSink is where every network's log messages go
+var logSink = newLogger()
+
+// logEnabled checks if a message logged at level would go anywhere
+// Callers check it before formatting anything, so levels which are turned off cost nothing
+func logEnabled(s *State, level C.int) bool {
+	threshold := logSink.level.Load()
+	if threshold == noLogSink {
+		threshold = C.LOG_ERROR
+		if s != nil && s.verbose {
+			threshold = C.LOG_DEBUG
+		}
 	}
+	return int32(level) >= threshold
+}
 
-	privateKey, err := crypto.UnmarshalPrivateKey(key)
-	if err != nil {
-		fmt.Println("Failed to unpack identity key!")
-		panic(err)
+// logf formats and logs a message (s is nil for messages which aren't about a particular network)
+func logf(s *State, level C.int, format string, args ...any) {
+	if !logEnabled(s, level) {
+		return
+	}
+	message := fmt.Sprintf(format, args...)
+	if logSink.level.Load() == noLogSink {
+		fmt.Println(message)
+		return
 	}
 
-	h, err := libp2p.New(
-		libp2p.ListenAddrStrings(listenAddress),
-		libp2p.Identity(privateKey))
-	if err != nil {
-		panic(err)
+	network := -1
+	if s != nil {
+		network = s.id
+	}
+	if logSink.ring.push(logRecord{level: level, network: network, time: time.Now(), message: message}) {
+		select {
+		case logSink.wake <- struct{}{}:
+		default: // The delivery goroutine has already been woken
+		}
 	}
-	localState.host = h
-	states[nid] = localState
+}
 
-	go discoverPeers(nid, states[nid].ctx, states[nid].host, discoveryTopic)
+// deliver hands staged log records to the log callback in batches, suppressing repeats of messages delivered within the last logRepeatWindow
+func (l *logger) deliver() {
+	var buffer messageBuffer // Reused for every batch, it lives as long as the process
+	records := make([]logRecord, 0, logBatchSize)
+	crecords := make([]C.LogRecord, 0, logBatchSize)
+	repeats := map[logRepeatKey]*logRepeat{}
+	sweep := time.NewTicker(logRepeatWindow)
+	for {
+		var flushed chan struct{}
+		select {
+		case <-l.wake:
+		case <-sweep.C:
+		case flushed = <-l.flush:
+		}
 
-	if fullyConnected {
-		ps, err := pubsub.NewFloodSub(localState.ctx, localState.host)
-		if err != nil {
-			panic(err)
+		// Once their window is over, suppressed messages are delivered one last time along with how often they repeated
+		now := time.Now()
+		records = records[:0]
+		for key, repeat := range repeats {
+			if now.Before(repeat.until) {
+				continue
+			}
+			if repeat.suppressed > 0 {
+				records = append(records, logRecord{level: key.level, network: key.network, time: now, repeated: repeat.suppressed, message: key.message})
+			}
+			delete(repeats, key)
 		}
-		localState.ps = ps
-	} else {
-		ps, err := pubsub.NewGossipSub(localState.ctx, localState.host)
-		if err != nil {
-			panic(err)
+		if dropped := l.ring.dropped.Swap(0); dropped > 0 {
+			records = append(records, logRecord{level: C.LOG_WARNING, network: -1, time: now,
+				message: fmt.Sprintf("%d log messages were dropped because the log callback couldn't keep up", dropped)})
 		}
-		localState.ps = ps
-	}
-
-	localState.topics = make(map[int]Topic)
 
-	states[nid] = localState
+		for {
+			record, ok := l.ring.pop()
+			if !ok {
+				break
+			}
+			key := logRepeatKey{record.level, record.network, record.message}
+			if repeat := repeats[key]; repeat != nil {
+				repeat.suppressed++
+				continue
+			}
+			if len(repeats) < maxTrackedLogMessages {
+				repeats[key] = &logRepeat{until: record.time.Add(logRepeatWindow)}
+			}
 
-	go trackPeers(nid, states[nid].ctx)
+			records = append(records, record)
+			if len(records) == logBatchSize {
+				crecords = l.send(&buffer, records, crecords)
+				records = records[:0]
+			}
+		}
+		crecords = l.send(&buffer, records, crecords)
 
-	// Make sure we can connect to the discovery topic!
-	if topic := subscribeToTopic(nid, discoveryTopic); topic < 0 {
-		return topic
+		if flushed != nil {
+			close(flushed)
+		}
 	}
-
-	return nid
 }
 
-// shutdown shuts down the library
-//
-//export shutdown
-func shutdown(nid int) {
-	states[nid].cancel()
+// send packs a batch of log records for C and passes them to the log callback
+func (l *logger) send(buffer *messageBuffer, records []logRecord, crecords []C.LogRecord) []C.LogRecord {
+	callback := l.callback.Load()
+	if len(records) == 0 || callback == nil {
+		return crecords // The callback was removed while the records were staged
+	}
 
-	for id := range states[nid].topics {
-		leaveTopic(nid, id)
+	// NOTE: The buffer gets reused for the next batch so C must copy anything it wants to keep!
+	size := 0
+	for _, record := range records {
+		size += len(record.message) + 1
 	}
-	states[nid].dht.Close()
-	states[nid].host.Close()
-	if !C.bridge_void_callback(C.int(nid), disconnectedCallbacks[nid]) {
-		panic("C error!")
+	buffer.reserve(size)
+	crecords = crecords[:0]
+	for _, record := range records {
+		message, messageSize := packField(buffer, record.message)
+		crecords = append(crecords, C.LogRecord{level: record.level, network: C.int(record.network), time: C.double(float64(record.time.UnixNano()) / 1e9),
+			repeated: C.uint(record.repeated), message: message, message_size: messageSize})
 	}
-
-	delete(messageCallbacks, nid)
-	delete(peerconnectedCallbacks, nid)
-	delete(peerDisconnectedCallbacks, nid)
-	delete(topicSubscribedCallbacks, nid)
-	delete(topicUnsubscribedCallbacks, nid)
-	delete(connectedCallbacks, nid)
-	delete(disconnectedCallbacks, nid)
-	delete(states, nid)
+	C.bridge_log_callback(&crecords[0], C.int(len(crecords)), callback.f, callback.userData)
+	return crecords
 }
 
-// localID returns the hashed ID of the current node
+// setLogCallback sets (or with a nil callback removes) the function every network's log messages at level or above are delivered to
 //
-//export localID
-func localID(nid int) *C.char {
-	return C.CString(string(states[nid].host.ID()))
+//export setLogCallback
+func setLogCallback(level C.int, callback C.log_callback, userData unsafe.Pointer) {
+	if callback == nil {
+		logSink.level.Store(noLogSink)
+		logSink.callback.Store(nil)
+		return
+	}
+
+	logSink.start.Do(func() {
+		go logSink.deliver()
+		logSink.started.Store(true)
+	})
+	logSink.callback.Store(&userCallback[C.log_callback]{callback, userData})
+	logSink.level.Store(int32(level))
 }
 
-// subscribeToTopic subscribes to a topic and begins listening to messages sent within it
+// flushLog waits until every log record staged so far has been delivered (and the previous log callback is no longer in use)
 //
-//export subscribeToTopic
-func subscribeToTopic(nid int, name string) int {
-	id := len(states[nid].topics)
-	if _, ok := states[nid].topics[id]; ok {
-		if states[nid].verbose {
-			fmt.Println("Failed to find topic: " + name)
-		}
-		return -1
+//export flushLog
+func flushLog() {
+	if !logSink.started.Load() {
+		return
 	}
+	done := make(chan struct{})
+	logSink.flush <- done
+	<-done
+}
 
-	topic, err := states[nid].ps.Join(name)
-	if err != nil {
-		panic(err)
+// notifyError tells C that something went wrong in the background, either by queuing an event or invoking the error callback
+func notifyError(s *State, errorCode C.int, description string) bool {
+	s.stats.errors.Add(1)
+	if logEnabled(s, C.LOG_WARNING) {
+		logf(s, C.LOG_WARNING, "%s", description)
+	}
+	if queueEvent(s, C.EVENT_ERROR, -1, -1, errorCode, description) {
+		return true
 	}
 
-	sub, err := topic.Subscribe()
-	if err != nil {
-		panic(err)
+	c := C.CString(description)
+	defer C.free(unsafe.Pointer(c))
+	callback := s.getCallbacks().error
+	if callback.f != nil { // Only calls which reach the application are profiled
+		defer s.stats.timeCallback(C.CALLBACK_ERROR, time.Now())
 	}
+	return bool(C.bridge_error_callback(C.int(s.id), errorCode, c, callback.f, callback.userData))
+}
 
-	states[nid].topics[id] = Topic{name: name, topic: topic, subscription: sub}
+/*
 
-	go reciever(nid, states[nid].ctx, states[nid].topics[id].subscription)
-	if !C.bridge_topic_callback(C.int(nid), C.int(id), topicSubscribedCallbacks[nid]) {
-		panic("C error!")
+
+
+ */
+
+// trafficStats counts the messages passing through a topic (or a whole network)
+// Every counter is an atomic so the publishing and receiving hot paths never take a lock
+type trafficStats struct {
+	messagesPublished atomic.Uint64
+	bytesPublished    atomic.Uint64
+	publishErrors     atomic.Uint64
+	messagesReceived  atomic.Uint64
+	bytesReceived     atomic.Uint64
+	latency           atomic.Pointer[latencyHistogram] // Allocated the first time a latency is recorded
+}
+
+// recordLatency records the publish to delivery latency of a message, allocating the histogram if needed
+func (t *trafficStats) recordLatency(latency time.Duration) {
+	h := t.latency.Load()
+	if h == nil {
+		t.latency.CompareAndSwap(nil, newLatencyHistogram())
+		h = t.latency.Load()
 	}
-	return id
+	h.record(latency)
 }
 
-// findTopic finds a topicID by name
-//
-//export findTopic
-func findTopic(nid int, name string) int {
-	for id, topic := range states[nid].topics {
-		if topic.name == name {
-			return id
-		}
+// published records the outcome of publishing a message
+func (t *trafficStats) published(size int, success bool) {
+	if !success {
+		t.publishErrors.Add(1)
+		return
 	}
+	t.messagesPublished.Add(1)
+	t.bytesPublished.Add(uint64(size))
+}
 
-	return -1
+// received records a batch of messages being handed to C
+func (t *trafficStats) received(count int, size int) {
+	t.messagesReceived.Add(uint64(count))
+	t.bytesReceived.Add(uint64(size))
 }
 
-// topicString returns the name of a topic given its TopicID
+// fill copies the counters into C
+func (t *trafficStats) fill(out *C.TopicStats) {
+	out.messages_published = C.ulonglong(t.messagesPublished.Load())
+	out.bytes_published = C.ulonglong(t.bytesPublished.Load())
+	out.publish_errors = C.ulonglong(t.publishErrors.Load())
+	out.messages_received = C.ulonglong(t.messagesReceived.Load())
+	out.bytes_received = C.ulonglong(t.bytesReceived.Load())
+}
+
+// networkStats counts a network's traffic (summed over every topic it has subscribed to) along with its callbacks and connection events
+type networkStats struct {
+	trafficStats
+	callbacks              atomic.Uint64 // Calls made into C callbacks
+	callbackTime           atomic.Int64  // Nanoseconds spent inside of them
+	peerConnectedEvents    atomic.Uint64
+	peerDisconnectedEvents atomic.Uint64
+	dials                  atomic.Uint64 // Successful connections made by discovery or connectPeer
+	failedDials            atomic.Uint64
+	errors                 atomic.Uint64 // Errors reported to C
+}
+
+// timeCallback records a call into C (of one of the CALLBACK_* kinds) which started at start (meant to be deferred)
+// Callers only record calls which actually reach one of the application's callbacks
+func (n *networkStats) timeCallback(kind C.int, start time.Time) {
+	elapsed := int64(time.Since(start))
+	n.callbacks.Add(1)
+	n.callbackTime.Add(elapsed)
+	callbackProfile[kind].calls.Add(1)
+	callbackProfile[kind].time.Add(elapsed)
+}
+
+// callbackProfile times every call into C (across all networks) by kind
+// The time includes crossing from Go into C and back, the C bridges separately time just the application's callbacks so the two costs can be told apart
+var callbackProfile [C.CALLBACK_KIND_COUNT]struct {
+	calls atomic.Uint64
+	time  atomic.Int64 // Nanoseconds
+}
+
+// getCallbackProfile fills in how many calls of each kind have been made into C and how long they took in total, optionally resetting the counts
 //
-//export topicString
-func topicString(nid int, topicID int) *C.char {
-	if t, ok := states[nid].topics[topicID]; ok {
-		return C.CString(t.name)
+//export getCallbackProfile
+func getCallbackProfile(out *C.CallbackProfile, reset bool) {
+	for kind := range callbackProfile {
+		calls, elapsed := callbackProfile[kind].calls.Load(), callbackProfile[kind].time.Load()
+		if reset {
+			calls, elapsed = callbackProfile[kind].calls.Swap(0), callbackProfile[kind].time.Swap(0)
+		}
+		out.calls[kind] = C.ulonglong(calls)
+		out.total_time[kind] = C.double(time.Duration(elapsed).Seconds())
 	}
-	return nil
 }
 
-// leaveTopic leaves a topic and stops listening to its messages
+// getStats fills in a network's runtime statistics
 //
-//export leaveTopic
-func leaveTopic(nid int, id int) bool {
-	if _, ok := states[nid].topics[id]; !ok {
+//export getStats
+func getStats(nid int, out *C.Stats) bool {
+	s := states.get(nid)
+	if s == nil || out == nil {
 		return false
 	}
-	if states[nid].topics[id].subscription != nil {
-		states[nid].topics[id].subscription.Cancel()
-	}
-	if states[nid].topics[id].topic != nil {
-		states[nid].topics[id].topic.Close()
-	}
-	states[nid].topics[id] = Topic{name: "invalid", topic: nil, subscription: nil} // Leave topic in list (technically a memory leak!) so that we don't have id conflicts!
 
-	if !C.bridge_topic_callback(C.int(nid), C.int(id), topicUnsubscribedCallbacks[nid]) {
-		panic("C error!")
+	s.stats.fill(&out.totals)
+	buffered := 0
+	s.RLock()
+	ids := s.topics.ids()
+	for _, id := range ids {
+		if t, ok := s.topics.get(id); ok {
+			buffered += len(t.messages)
+		}
 	}
+	s.RUnlock()
+	out.totals.buffered_messages = C.int(buffered)
+	out.totals.peers = C.int(s.peers.peerCount())
+	out.topics = C.int(len(ids))
+	out.connected_peers = C.int(len(s.host.Network().Peers()))
+	out.callbacks = C.ulonglong(s.stats.callbacks.Load())
+	out.callback_time = C.double(time.Duration(s.stats.callbackTime.Load()).Seconds())
+	out.peer_connected_events = C.ulonglong(s.stats.peerConnectedEvents.Load())
+	out.peer_disconnected_events = C.ulonglong(s.stats.peerDisconnectedEvents.Load())
+	out.dials = C.ulonglong(s.stats.dials.Load())
+	out.failed_dials = C.ulonglong(s.stats.failedDials.Load())
+	out.errors = C.ulonglong(s.stats.errors.Load())
+	out.publish_queue_depth = C.int(len(s.getPublisher().jobs))
 	return true
 }
 
-// broadcastMessage broadcasts a message to all other peers listening to a topic
+// getTopicStats fills in a topic's traffic statistics
 //
-//export broadcastMessage
-func broadcastMessage(nid int, message string, topicID int) bool {
-	if t, ok := states[nid].topics[topicID]; !ok || t.topic == nil {
+//export getTopicStats
+func getTopicStats(nid int, topicID int, out *C.TopicStats) bool {
+	s := states.get(nid)
+	if s == nil || out == nil {
 		return false
 	}
-
-	if err := states[nid].topics[topicID].topic.Publish(states[nid].ctx, []byte(message)); err != nil && states[nid].verbose {
-		fmt.Println("### Publish error:", err)
+	t, ok := s.getTopic(topicID)
+	if !ok || t.stats == nil {
 		return false
 	}
 
+	t.stats.fill(out)
+	out.buffered_messages = C.int(len(t.messages))
+	out.peers = C.int(s.peers.size(topicID))
 	return true
 }
 
-// initDHT initializes the DHT used to find peers
-func initDHT(nid int, ctx context.Context, h host.Host) *dht.IpfsDHT {
-	// Start a DHT, for use in peer discovery. We can't just make a new DHT
-	// client because we want each peer to maintain its own local copy of the
-	// DHT, so that the bootstrapping node of the DHT can go down without
-	// inhibiting future peer discovery.
-	kademliaDHT, err := dht.New(ctx, h)
-	if err != nil {
-		panic(err)
+// latencyHeaderMagic starts the header a network tracking latency stamps on the messages it publishes, it is followed by the publish time
+// The publish time is wall-clock (Unix nanoseconds) so it can be compared across processes, latencies between machines include their clock skew
+const (
+	latencyHeaderMagic = "\xf3S2L"
+	latencyHeaderSize  = len(latencyHeaderMagic) + 8
+)
+
+// stampLatency copies a message behind a latency header recording now as its publish time
+func stampLatency(message []byte, now time.Time) []byte {
+	out := make([]byte, latencyHeaderSize+len(message))
+	copy(out, latencyHeaderMagic)
+	binary.LittleEndian.PutUint64(out[len(latencyHeaderMagic):], uint64(now.UnixNano()))
+	copy(out[latencyHeaderSize:], message)
+	return out
+}
+
+// splitLatency separates a message's payload from its latency header, returning the Unix nanoseconds it was published at (0 if it wasn't stamped)
+func splitLatency(data []byte) ([]byte, int64) {
+	if len(data) < latencyHeaderSize || string(data[:len(latencyHeaderMagic)]) != latencyHeaderMagic {
+		return data, 0
 	}
-	if err = kademliaDHT.Bootstrap(ctx); err != nil {
-		panic(err)
+	return data[latencyHeaderSize:], int64(binary.LittleEndian.Uint64(data[len(latencyHeaderMagic):]))
+}
+
+// Latencies are recorded into HDR style buckets: each power of two is split into 1 << latencySubBucketBits linear buckets (~3% precision)
+const (
+	latencySubBucketBits = 5
+	latencySubBucketMask = 1<<latencySubBucketBits - 1
+	latencyBuckets       = 64 << latencySubBucketBits
+)
+
+// latencyBucket returns the bucket a latency (in nanoseconds) falls into
+func latencyBucket(nanoseconds uint64) int {
+	if nanoseconds <= latencySubBucketMask {
+		return int(nanoseconds)
 	}
-	var wg sync.WaitGroup
-	for _, peerAddr := range dht.DefaultBootstrapPeers {
-		peerinfo, _ := peer.AddrInfoFromP2pAddr(peerAddr)
-		wg.Add(1)
-		go func() {
-			defer wg.Done()
-			if err := h.Connect(ctx, *peerinfo); err != nil && states[nid].verbose {
-				fmt.Println("Bootstrap warning:", err)
-			}
-		}()
+	shift := 63 - latencySubBucketBits - bits.LeadingZeros64(nanoseconds)
+	return (shift+1)<<latencySubBucketBits + int(nanoseconds>>shift&latencySubBucketMask)
+}
+
+// latencyBucketMidpoint returns the latency (in nanoseconds) in the middle of a bucket
+func latencyBucketMidpoint(bucket int) float64 {
+	major, minor := bucket>>latencySubBucketBits, bucket&latencySubBucketMask
+	if major == 0 {
+		return float64(minor)
 	}
-	wg.Wait()
+	width := uint64(1) << (major - 1)
+	return float64((latencySubBucketMask+1+uint64(minor))*width) + float64(width)/2
+}
 
-	return kademliaDHT
+// latencyHistogram is a fixed size histogram of latencies, every field is an atomic so recievers never take a lock to record into it
+type latencyHistogram struct {
+	counts [latencyBuckets]atomic.Uint64
+	sum    atomic.Int64 // Nanoseconds
+	min    atomic.Int64
+	max    atomic.Int64
 }
 
-// discoverPeers discovers peers and establishes connections to them
-func discoverPeers(nid int, inCTX context.Context, h host.Host, advertisingTopic string) {
-	ctx, cancel := context.WithTimeout(inCTX, time.Duration(states[nid].connectionTimeout*float64(time.Second)))
-	defer cancel()
-	kademliaDHT := initDHT(nid, ctx, h)
-	if localState, ok := states[nid]; ok {
-		localState.dht = kademliaDHT
-		states[nid] = localState
+// newLatencyHistogram creates an empty histogram
+func newLatencyHistogram() *latencyHistogram {
+	h := &latencyHistogram{}
+	h.min.Store(math.MaxInt64)
+	return h
+}
+
+// record adds a latency to the histogram (negative latencies, caused by clock skew, are recorded as 0)
+func (h *latencyHistogram) record(latency time.Duration) {
+	nanoseconds := int64(latency)
+	if nanoseconds < 0 {
+		nanoseconds = 0
 	}
+	h.counts[latencyBucket(uint64(nanoseconds))].Add(1)
+	h.sum.Add(nanoseconds)
+	for current := h.min.Load(); nanoseconds < current; current = h.min.Load() {
+		if h.min.CompareAndSwap(current, nanoseconds) {
+			break
+		}
+	}
+	for current := h.max.Load(); nanoseconds > current; current = h.max.Load() {
+		if h.max.CompareAndSwap(current, nanoseconds) {
+			break
+		}
+	}
+}
+
+// fill summarizes the histogram into C, optionally resetting it so the next summary only covers the latencies recorded after this one
+func (h *latencyHistogram) fill(out *C.LatencyStats, reset bool) {
+	var counts [latencyBuckets]uint64
+	var total uint64
+	for i := range h.counts {
+		if reset {
+			counts[i] = h.counts[i].Swap(0)
+		} else {
+			counts[i] = h.counts[i].Load()
+		}
+		total += counts[i]
+	}
+	sum, min, max := h.sum.Load(), h.min.Load(), h.max.Load()
+	if reset {
+		sum, min, max = h.sum.Swap(0), h.min.Swap(math.MaxInt64), h.max.Swap(0)
+	}
+
+	*out = C.LatencyStats{count: C.ulonglong(total)}
+	if total == 0 {
+		return
+	}
+	seconds := func(nanoseconds float64) C.double { return C.double(nanoseconds / float64(time.Second)) }
+	percentile := func(p float64) C.double {
+		target, seen := uint64(math.Ceil(p*float64(total))), uint64(0)
+		for i, count := range counts {
+			if seen += count; seen >= target && seen > 0 {
+				return seconds(latencyBucketMidpoint(i))
+			}
+		}
+		return seconds(float64(max))
+	}
+	out.min = seconds(float64(min))
+	out.mean = seconds(float64(sum) / float64(total))
+	out.p50 = percentile(0.5)
+	out.p90 = percentile(0.9)
+	out.p99 = percentile(0.99)
+	out.p999 = percentile(0.999)
+	out.max = seconds(float64(max))
+}
+
+// setLatencyTracking controls whether a network stamps the messages it publishes with their publish time and records the latency of stamped messages it receives
+// The header is only removed while tracking is enabled, so every network sharing a topic should track latency (or not) together
+//
+//export setLatencyTracking
+func setLatencyTracking(nid int, enable bool) {
+	states.configure(nid, func(s *State) { s.latencyTracking.Store(enable) })
+}
+
+// latencyStats summarizes the publish to delivery latencies a topic has recorded, optionally resetting them (for periodic dumps)
+//
+//export latencyStats
+func latencyStats(nid int, topicID int, out *C.LatencyStats, reset bool) bool {
+	s := states.get(nid)
+	if s == nil || out == nil {
+		return false
+	}
+	t, ok := s.getTopic(topicID)
+	if !ok || t.stats == nil {
+		return false
+	}
+
+	if h := t.stats.latency.Load(); h != nil {
+		h.fill(out, reset)
+	} else {
+		*out = C.LatencyStats{}
+	}
+	return true
+}
+
+// Topic represents a pubsub topic
+type Topic struct {
+	name         string
+	topic        *pubsub.Topic
+	subscription *pubsub.Subscription
+	messages     chan *pubsub.Message // Received messages waiting for the reciever to hand them to C
+	stats        *trafficStats
+	stopWatching context.CancelFunc // Stops the topic's peer event watcher
+	watcherDone  chan struct{}      // Closed once the watcher has stopped (and released its event handler)
+}
+
+// Topic IDs pack the index of the topic's slot in its low bits and the slot's generation above them
+// Each time a slot is reused its generation changes, so a stale ID doesn't refer to whatever topic took over its slot
+const (
+	topicSlotBits       = 20
+	topicSlotMask       = 1<<topicSlotBits - 1
+	topicGenerationMask = 1<<(31-topicSlotBits) - 1 // Keeps IDs positive when passed to C as an int
+)
+
+// topicSlot is an entry in a topicTable, it holds a topic while in use
+type topicSlot struct {
+	Topic
+	generation int
+	used       bool
+}
+
+// topicTable stores a network's topics in a slot array (with a name index) so that subscribing, finding, and leaving are all O(1)
+// Freed slots are reused oldest first, so a slot's generation only wraps around after it has been reused many times
+type topicTable struct {
+	slots  []topicSlot
+	free   []int          // Indices of unused slots, in the order they were freed
+	byName map[string]int // Maps a topic name to its ID
+}
+
+// newTopicTable creates an empty topicTable, the first topic added gets ID 0
+func newTopicTable() topicTable {
+	return topicTable{byName: make(map[string]int)}
+}
+
+// slot returns the slot a topic ID refers to, or nil if the ID is stale or invalid
+func (t *topicTable) slot(id int) *topicSlot {
+	index := id & topicSlotMask
+	if id < 0 || index >= len(t.slots) {
+		return nil
+	}
+	slot := &t.slots[index]
+	if !slot.used || slot.generation != id>>topicSlotBits {
+		return nil
+	}
+	return slot
+}
+
+// get returns the topic with the given ID
+func (t *topicTable) get(id int) (Topic, bool) {
+	if slot := t.slot(id); slot != nil {
+		return slot.Topic, true
+	}
+	return Topic{}, false
+}
+
+// find returns the ID of the topic with the given name, or -1 if there isn't one
+func (t *topicTable) find(name string) int {
+	if id, ok := t.byName[name]; ok {
+		return id
+	}
+	return -1
+}
+
+// add claims a slot for a topic, returning its ID or -1 if a topic with the same name already exists (or the table is full)
+func (t *topicTable) add(topic Topic) int {
+	if _, ok := t.byName[topic.name]; ok {
+		return -1
+	}
+
+	var index int
+	if len(t.free) > 0 {
+		index = t.free[0]
+		t.free = t.free[1:]
+	} else if len(t.slots) <= topicSlotMask {
+		index = len(t.slots)
+		t.slots = append(t.slots, topicSlot{})
+	} else {
+		return -1
+	}
+
+	slot := &t.slots[index]
+	slot.Topic = topic
+	slot.used = true
+	id := slot.generation<<topicSlotBits | index
+	t.byName[topic.name] = id
+	return id
+}
+
+// set replaces the topic stored with the given ID (its name must not change)
+func (t *topicTable) set(id int, topic Topic) {
+	if slot := t.slot(id); slot != nil {
+		slot.Topic = topic
+	}
+}
+
+// remove frees the slot of the topic with the given ID, returning the topic it held
+func (t *topicTable) remove(id int) (Topic, bool) {
+	slot := t.slot(id)
+	if slot == nil {
+		return Topic{}, false
+	}
+
+	topic := slot.Topic
+	delete(t.byName, topic.name)
+	slot.Topic = Topic{}
+	slot.used = false
+	slot.generation = (slot.generation + 1) & topicGenerationMask
+	t.free = append(t.free, id&topicSlotMask)
+	return topic, true
+}
+
+// ids returns the IDs of every topic in the table
+func (t *topicTable) ids() []int {
+	ids := make([]int, 0, len(t.byName))
+	for _, id := range t.byName {
+		ids = append(ids, id)
+	}
+	return ids
+}
+
+// State represents the State of a network connection
+// Everything set by initialize is never modified afterwards, the remaining fields are guarded by the embedded lock
+type State struct {
+	sync.RWMutex
+	id                int
+	running           atomic.Bool // Set once initialize has finished setting up the network (and cleared again by shutdown)
+	verbose           bool
+	connectionTimeout float64
+	ctx               context.Context
+	cancel            context.CancelFunc
+	host              host.Host
+	ps                *pubsub.PubSub
+	recievers         *sync.WaitGroup // Tracks running recievers so shutdown can wait for them to stop touching C memory
+	background        *sync.WaitGroup // Tracks discovery and peer tracking goroutines (started with spawn) so shutdown can wait for them to stop notifying C
+	peerEvents        *peerEventQueue // Peer events from every topic, waiting for trackPeers
+	peers             *peerTracker    // The peers in each topic
+	handles           *peerHandles    // Dense handles for every peer seen
+	discovery         *discovery      // Tracks whether a peer has been connected to yet
+	dialer            *dialScheduler  // Limits how many peers are dialed at once
+	stats             networkStats    // Lock-free counters read by getStats
+	latencyTracking   atomic.Bool     // Stamp published messages with their publish time and record the latency of received ones
+	simulation        *simulation     // The simulation the network is running inside (nil when using real sockets)
+
+	dht         *dht.IpfsDHT
+	mdns        mdns.Service
+	topics      topicTable      // Maps a topicID to the above topic struct
+	publisher   *asyncPublisher // Publishes messages passed to broadcastMessageAsync
+	callbacks   callbacks
+	batchLimits batchLimits
+	dialLimits  dialLimits
+	poll        pollState
+	closed      bool // Set once shutdown has begun, after which no poll state can be installed
+}
+
+// getCallbacks returns a copy of the network's callbacks, so they can be invoked without holding the lock
+func (s *State) getCallbacks() callbacks {
+	s.RLock()
+	defer s.RUnlock()
+	return s.callbacks
+}
+
+// getBatchLimits returns how incoming messages should be grouped together
+func (s *State) getBatchLimits() batchLimits {
+	s.RLock()
+	defer s.RUnlock()
+	return s.batchLimits
+}
+
+// getDialLimits returns how many peers may be dialed at once, and for how long
+func (s *State) getDialLimits() dialLimits {
+	s.RLock()
+	defer s.RUnlock()
+	return s.dialLimits
+}
+
+// getPoll returns the network's C owned poll queues
+func (s *State) getPoll() pollState {
+	s.RLock()
+	defer s.RUnlock()
+	return s.poll
+}
+
+// spawn runs f in a background goroutine which shutdown waits for, returning false (without running f) once shutdown has begun
+func (s *State) spawn(f func()) bool {
+	s.RLock()
+	defer s.RUnlock()
+	if s.closed {
+		return false
+	}
+	s.background.Add(1)
+	go func() {
+		defer s.background.Done()
+		f()
+	}()
+	return true
+}
+
+// getTopic looks up a topic by its ID
+func (s *State) getTopic(topicID int) (Topic, bool) {
+	s.RLock()
+	defer s.RUnlock()
+	return s.topics.get(topicID)
+}
+
+// getPublisher returns the network's asynchronous publisher
+func (s *State) getPublisher() *asyncPublisher {
+	s.RLock()
+	defer s.RUnlock()
+	return s.publisher
+}
+
+// stateTable maps network IDs to their states
+// IDs are allocated monotonically and never reused, so a stale ID can never reach a network created after it was shutdown
+type stateTable struct {
+	sync.RWMutex
+	states map[int]*State
+	next   int // The ID the next network to be initialized will get
+}
+
+var states = stateTable{states: make(map[int]*State)}
+
+// get returns the state of a running network, or nil if the ID isn't valid
+func (t *stateTable) get(nid int) *State {
+	t.RLock()
+	s := t.states[nid]
+	t.RUnlock()
+	if s == nil || !s.running.Load() {
+		return nil
+	}
+	return s
+}
+
+// reserve returns the state of a network which may not have been initialized yet, so that it can be configured ahead of time
+// Returns nil if the ID belongs to a network which has already been shutdown, or is further ahead than the next network to be initialized
+func (t *stateTable) reserve(nid int) *State {
+	t.RLock()
+	s := t.states[nid]
+	t.RUnlock()
+	if s != nil {
+		return s
+	}
+
+	t.Lock()
+	defer t.Unlock()
+	if s = t.states[nid]; s == nil && nid == t.next {
+		s = &State{id: nid, batchLimits: defaultBatchLimits, dialLimits: defaultDialLimits}
+		t.states[nid] = s
+	}
+	return s
+}
+
+// configure applies a change to a (possibly not yet initialized) network's state while holding its lock
+func (t *stateTable) configure(nid int, change func(s *State)) {
+	if s := t.reserve(nid); s != nil {
+		s.Lock()
+		change(s)
+		s.Unlock()
+	}
+}
+
+// allocate hands out the next network ID, along with any state which was configured for it before it was initialized
+func (t *stateTable) allocate() *State {
+	t.Lock()
+	defer t.Unlock()
+	nid := t.next
+	t.next++
+	s, ok := t.states[nid]
+	if !ok {
+		s = &State{id: nid, batchLimits: defaultBatchLimits, dialLimits: defaultDialLimits}
+		t.states[nid] = s
+	}
+	return s
+}
+
+// remove forgets a network, its ID will never be valid again
+func (t *stateTable) remove(nid int) {
+	t.Lock()
+	delete(t.states, nid)
+	t.Unlock()
+}
+
+//export networksCount
+func networksCount() C.int {
+	states.RLock()
+	defer states.RUnlock()
+	count := 0
+	for _, s := range states.states {
+		if s.running.Load() {
+			count++
+		}
+	}
+	return C.int(count)
+}
+
+// nextNetwork returns the ID the next network to be initialized will get (so that it can be configured ahead of time)
+//
+//export nextNetwork
+func nextNetwork() int {
+	states.RLock()
+	defer states.RUnlock()
+	return states.next
+}
+
+//export networkValid
+func networkValid(nid int) bool {
+	return states.get(nid) != nil
+}
+
+//export base64Encode
+func base64Encode(str *C.char, size C.int) (*C.char, C.int) {
+	encoded := b64.URLEncoding.EncodeToString(C.GoBytes(unsafe.Pointer(str), size))
+	return C.CString(encoded), C.int(len(encoded))
+}
+
+//export base64Decode
+func base64Decode(encoded string) (*C.char, C.int) {
+	decoded, ok := b64.URLEncoding.DecodeString(encoded)
+	if ok != nil {
+		return nil, -1
+	}
+	return (*C.char)(C.CBytes(decoded)), C.int(len(decoded))
+}
+
+// generateCKey exports a cryptographic key to C
+//
+//export generateCKey
+func generateCKey() (*C.char, C.int) {
+	str := string(generateKey())
+	return C.CString(str), C.int(len(str))
+}
+
+// generateKey generates a new cryptographic key
+func generateKey() []byte {
+	privKey, _, err := crypto.GenerateECDSAKeyPair(rand.Reader)
+	if err != nil {
+		panic(err)
+	}
+
+	keyBytes, err := crypto.MarshalPrivateKey(privKey)
+	if err != nil {
+		panic(err)
+	}
+
+	return keyBytes
+}
+
+// initialize starts up a connection to the p2p network and initializes some library states
+//
+//export initialize
+func initialize(listenAddress string, discoveryTopic string, keyString string, connectionTimeout float64, fullyConnected bool, verbose bool,
+	bootstrapPeers **C.char, bootstrapPeersCount C.int, disablePublicBootstrap bool, discoveryMode C.int, targetPeers C.int, simulationID int,
+	connectedCallback C.void_callback, errorCallback C.error_callback, callbackUserData unsafe.Pointer) int {
+	var sim *simulation
+	if simulationID > 0 {
+		if sim = simulations.get(simulationID); sim == nil {
+			logf(nil, C.LOG_ERROR, "Invalid simulation: %d", simulationID)
+			return -1
+		}
+		disablePublicBootstrap = true // The public bootstrap peers can't be reached from inside a simulation
+	}
+
+	options := discoveryOptions{mode: discoveryMode, disablePublicBootstrap: disablePublicBootstrap, targetPeers: int(targetPeers)}
+	if options.targetPeers <= 0 {
+		options.targetPeers = defaultTargetPeers
+	}
+	if bootstrapPeers != nil && bootstrapPeersCount > 0 {
+		for _, address := range unsafe.Slice(bootstrapPeers, bootstrapPeersCount) {
+			info, err := peer.AddrInfoFromString(C.GoString(address))
+			if err != nil {
+				logf(nil, C.LOG_ERROR, "Ignoring invalid bootstrap peer %s error: %v", C.GoString(address), err)
+				continue
+			}
+			options.bootstrapPeers = append(options.bootstrapPeers, *info)
+		}
+	}
+
+	s := states.allocate()
+	s.verbose = verbose
+	s.connectionTimeout = connectionTimeout
+
+	// Callbacks passed in here (instead of set ahead of time) are in place before any other thread can learn the network's ID
+	s.Lock()
+	if connectedCallback != nil {
+		s.callbacks.connected = userCallback[C.void_callback]{connectedCallback, callbackUserData}
+	}
+	if errorCallback != nil {
+		s.callbacks.error = userCallback[C.error_callback]{errorCallback, callbackUserData}
+	}
+	s.Unlock()
+
+	ctx, cancel := context.WithCancel(context.Background())
+	s.ctx = ctx
+	s.cancel = cancel
+
+	key := []byte(keyString)
+	if len(key) <= 0 && sim != nil {
+		key = sim.generateKey()
+	} else if len(key) <= 0 {
+		key = generateKey()
+	}
+
+	privateKey, err := crypto.UnmarshalPrivateKey(key)
+	if err != nil {
+		logf(nil, C.LOG_ERROR, "Failed to unpack identity key!")
+		panic(err)
+	}
+
+	var h host.Host
+	var pubsubOptions []pubsub.Option
+	if sim != nil {
+		h, err = sim.join(privateKey)
+		if err == nil {
+			pubsubOptions = append(pubsubOptions, pubsub.WithAppSpecificRpcInspector(sim.inspector(h.ID())))
+		}
+	} else {
+		h, err = libp2p.New(
+			libp2p.ListenAddrStrings(listenAddress),
+			libp2p.Identity(privateKey))
+	}
+	if err != nil {
+		panic(err)
+	}
+	s.host = h
+	s.simulation = sim
+
+	if fullyConnected {
+		ps, err := pubsub.NewFloodSub(s.ctx, s.host, pubsubOptions...)
+		if err != nil {
+			panic(err)
+		}
+		s.ps = ps
+	} else {
+		ps, err := pubsub.NewGossipSub(s.ctx, s.host, pubsubOptions...)
+		if err != nil {
+			panic(err)
+		}
+		s.ps = ps
+	}
+
+	s.recievers = &sync.WaitGroup{}
+	s.background = &sync.WaitGroup{}
+	s.peerEvents = newPeerEventQueue()
+	s.peers = newPeerTracker()
+	s.handles = newPeerHandles()
+	s.handles.intern(s.host.ID()) // We are always handle 0
+	s.discovery = newDiscovery(options.targetPeers)
+	s.dialer = newDialScheduler()
+	s.Lock()
+	s.topics = newTopicTable()
+	if s.publisher == nil {
+		s.publisher = newAsyncPublisher(defaultPublishQueueDepth, defaultPublishWorkers, defaultPublishQueueDepth*3/4, defaultPublishQueueDepth/4)
+	}
+	s.Unlock()
+	s.running.Store(true)
+
+	s.spawn(func() { discoverPeers(s, discoveryTopic, options) })
+	s.spawn(func() { trackPeers(s) })
+
+	// Make sure we can connect to the discovery topic!
+	if topic := subscribeToTopic(s.id, discoveryTopic); topic < 0 {
+		return topic
+	}
+
+	return s.id
+}
+
+// shutdown shuts down the library, returning the network's poll state (if any) for C to free
+//
+//export shutdown
+func shutdown(nid int) unsafe.Pointer {
+	s := states.get(nid)
+	if s == nil {
+		return nil
+	}
+	s.Lock()
+	running := s.running.CompareAndSwap(true, false)
+	s.closed = s.closed || running
+	s.Unlock()
+	if !running {
+		return nil
+	}
+	s.cancel()
+	s.dialer.wake()
+
+	s.RLock()
+	ids := s.topics.ids()
+	s.RUnlock()
+	for _, id := range ids {
+		s.leave(id)
+	}
+	s.recievers.Wait()
+	s.getPublisher().stop(s)
+
+	s.RLock()
+	kademliaDHT, mdnsService := s.dht, s.mdns
+	s.RUnlock()
+	if kademliaDHT != nil {
+		kademliaDHT.Close()
+	}
+	if mdnsService != nil {
+		mdnsService.Close()
+	}
+	if s.simulation != nil {
+		s.simulation.leave(s.host.ID())
+	}
+	s.host.Close()
+	s.background.Wait() // Nothing else can queue events or invoke callbacks once discovery and peer tracking have stopped
+
+	// NOTE: The poll state is freed as soon as this returns, so the disconnected event always goes to the callback (even when events are queued)
+	if !callNetwork(s, s.getCallbacks().disconnected) {
+		panic("C error!")
+	}
+
+	states.remove(nid)
+	s.handles.free() // Nothing can look up a handle once the network has been removed
+	s.Lock()
+	poll := s.poll
+	s.poll = pollState{}      // Anything still holding the state (such as a late queueEvent) sees it is gone
+	s.callbacks = callbacks{} // The callbacks' userData (such as a C++ Network) may be destroyed as soon as this returns
+	s.Unlock()
+	return poll.state
+}
+
+// localID returns the hashed ID of the current node
+//
+//export localID
+func localID(nid int) *C.char {
+	s := states.get(nid)
+	if s == nil {
+		return nil
+	}
+	return C.CString(string(s.host.ID()))
+}
+
+// listenAddresses returns the multiaddrs (including our peer ID) that other nodes can use to connect to us directly, separated by newlines
+//
+//export listenAddresses
+func listenAddresses(nid int) *C.char {
+	s := states.get(nid)
+	if s == nil {
+		return nil
+	}
+
+	addresses := make([]string, 0)
+	for _, address := range s.host.Addrs() {
+		addresses = append(addresses, address.String()+"/p2p/"+s.host.ID().String())
+	}
+	return C.CString(strings.Join(addresses, "\n"))
+}
+
+// subscribeToTopic subscribes to a topic and begins listening to messages sent within it
+//
+//export subscribeToTopic
+func subscribeToTopic(nid int, name string) int {
+	s := states.get(nid)
+	if s == nil {
+		return -1
+	}
+
+	// Claim an ID (and make sure nobody else is joining the same topic) before doing the slow work without the lock
+	s.Lock()
+	id := s.topics.add(Topic{name: name})
+	s.Unlock()
+	if id < 0 {
+		if logEnabled(s, C.LOG_WARNING) {
+			logf(s, C.LOG_WARNING, "Failed to subscribe to topic: %s", name)
+		}
+		return -1
+	}
+
+	topic, err := s.ps.Join(name)
+	if err != nil {
+		return s.abandonTopic(id, name, err)
+	}
+
+	sub, err := topic.Subscribe()
+	if err != nil {
+		topic.Close()
+		return s.abandonTopic(id, name, err)
+	}
+
+	handler, err := topic.EventHandler()
+	if err != nil {
+		sub.Cancel()
+		closeTopic(s, topic)
+		return s.abandonTopic(id, name, err)
+	}
+
+	s.Lock()
+	if !s.running.Load() { // Shutdown started while we were joining
+		s.topics.remove(id)
+		s.Unlock()
+		handler.Cancel()
+		sub.Cancel()
+		closeTopic(s, topic)
+		return -1
+	}
+	watchCtx, stopWatching := context.WithCancel(s.ctx)
+	watcherDone := make(chan struct{})
+	messages, stats := make(chan *pubsub.Message, subscriptionBufferSize), &trafficStats{}
+	s.topics.set(id, Topic{name: name, topic: topic, subscription: sub, messages: messages, stats: stats, stopWatching: stopWatching, watcherDone: watcherDone})
+	s.recievers.Add(1)
+	s.Unlock()
+
+	go watchTopic(watchCtx, s, id, handler, watcherDone)
+
+	go func() {
+		defer s.recievers.Done()
+		reciever(s, sub, messages, stats)
+	}()
+	if !notifyTopic(s, C.EVENT_TOPIC_SUBSCRIBED, id, s.getCallbacks().topicSubscribed) {
+		panic("C error!")
+	}
+	return id
+}
+
+// abandonTopic releases the ID claimed by a subscription which failed partway through
+func (s *State) abandonTopic(id int, name string, err error) int {
+	s.Lock()
+	s.topics.remove(id)
+	s.Unlock()
+	if logEnabled(s, C.LOG_WARNING) {
+		logf(s, C.LOG_WARNING, "Failed to subscribe to topic %s: %v", name, err)
+	}
+	return -1
+}
+
+// findTopic finds a topicID by name
+//
+//export findTopic
+func findTopic(nid int, name string) int {
+	s := states.get(nid)
+	if s == nil {
+		return -1
+	}
+
+	s.RLock()
+	defer s.RUnlock()
+	return s.topics.find(name)
+}
+
+// topicString returns the name of a topic given its TopicID
+//
+//export topicString
+func topicString(nid int, topicID int) *C.char {
+	if s := states.get(nid); s != nil {
+		if t, ok := s.getTopic(topicID); ok {
+			return C.CString(t.name)
+		}
+	}
+	return nil
+}
+
+// leaveTopic leaves a topic and stops listening to its messages
+//
+//export leaveTopic
+func leaveTopic(nid int, id int) bool {
+	if s := states.get(nid); s != nil {
+		return s.leave(id)
+	}
+	return false
+}
+
+// leave leaves a topic and stops listening to its messages
+func (s *State) leave(id int) bool {
+	s.Lock()
+	t, ok := s.topics.get(id)
+	if !ok || t.topic == nil { // Topics which are still being joined (or left) can't be left yet
+		s.Unlock()
+		return false
+	}
+	s.topics.set(id, Topic{name: t.name}) // The name stays reserved until pubsub has closed the topic, otherwise joining it again would fail
+	s.Unlock()
+
+	if t.subscription != nil {
+		t.subscription.Cancel()
+	}
+	if t.stopWatching != nil {
+		t.stopWatching()
+		<-t.watcherDone // The topic can't be closed while its event handler is still open
+	}
+	closeTopic(s, t.topic)
+	s.Lock()
+	s.topics.remove(id)
+	s.Unlock()
+
+	if !notifyTopic(s, C.EVENT_TOPIC_UNSUBSCRIBED, id, s.getCallbacks().topicUnsubscribed) {
+		panic("C error!")
+	}
+	return true
+}
+
+// closeTopic closes a pubsub topic, retrying while it still has subscriptions (cancelling one is asynchronous) until it closes or the network shuts down
+func closeTopic(s *State, topic *pubsub.Topic) {
+	for topic.Close() != nil {
+		select {
+		case <-s.ctx.Done():
+			return
+		case <-time.After(time.Millisecond):
+		}
+	}
+}
+
+// publish broadcasts a message to all other peers listening to a topic
+func publish(s *State, topicID int, message []byte) bool {
+	t, ok := s.getTopic(topicID)
+	if !ok || t.topic == nil {
+		s.stats.published(len(message), false)
+		return false
+	}
+
+	size := len(message)
+	if s.latencyTracking.Load() {
+		message = stampLatency(message, time.Now())
+	}
+	err := t.topic.Publish(s.ctx, message)
+	t.stats.published(size, err == nil)
+	s.stats.published(size, err == nil)
+	if err != nil {
+		if logEnabled(s, C.LOG_WARNING) {
+			logf(s, C.LOG_WARNING, "Publish error: %v", err)
+		}
+		return false
+	}
+
+	return true
+}
+
+// broadcastMessage broadcasts a message to all other peers listening to a topic
+//
+//export broadcastMessage
+func broadcastMessage(nid int, message string, topicID int) bool {
+	s := states.get(nid)
+	if s == nil {
+		return false
+	}
+	return publish(s, topicID, []byte(message))
+}
+
+// broadcastMessages broadcasts a batch of messages (each to its own topic), optionally recording whether each one succeeded in results
+//
+//export broadcastMessages
+func broadcastMessages(nid int, messages *C.OutMessage, count C.int, results *C.bool) C.int {
+	s := states.get(nid)
+	if s == nil || count <= 0 {
+		return 0
+	}
+
+	var statuses []C.bool
+	if results != nil {
+		statuses = unsafe.Slice(results, count)
+	}
+
+	published := 0
+	for i, m := range unsafe.Slice(messages, count) {
+		success := publish(s, int(m.topic), C.GoBytes(unsafe.Pointer(m.data), m.size))
+		if success {
+			published++
+		}
+		if statuses != nil {
+			statuses[i] = C.bool(success)
+		}
+	}
+	return C.int(published)
+}
+
+// publishJob is a message waiting to be published by an asyncPublisher
+type publishJob struct {
+	topicID  int
+	message  []byte
+	callback C.publish_callback
+	userData unsafe.Pointer
+}
+
+const (
+	defaultPublishQueueDepth = 1024
+	defaultPublishWorkers    = 4
+)
+
+// asyncPublisher publishes messages from a bounded queue on a pool of worker goroutines
+// Once the queue fills to its high watermark new messages are rejected until it drains back down to its low watermark
+type asyncPublisher struct {
+	sync.Mutex    // Guards throttled and stopped, so throttling is always decided against the queue's current length
+	jobs          chan publishJob
+	workers       int
+	highWatermark int
+	lowWatermark  int
+	throttled     bool
+	stopped       bool
+	started       sync.Once
+	running       sync.WaitGroup // The workers
+}
+
+// newAsyncPublisher creates a (not yet running) asyncPublisher
+func newAsyncPublisher(depth int, workers int, highWatermark int, lowWatermark int) *asyncPublisher {
+	if depth < 1 {
+		depth = 1
+	}
+	if workers < 1 {
+		workers = 1
+	}
+	if highWatermark < 1 || highWatermark > depth {
+		highWatermark = depth
+	}
+	if lowWatermark < 0 || lowWatermark >= highWatermark {
+		lowWatermark = highWatermark - 1
+	}
+
+	return &asyncPublisher{
+		jobs:          make(chan publishJob, depth),
+		workers:       workers,
+		highWatermark: highWatermark,
+		lowWatermark:  lowWatermark,
+	}
+}
+
+// enqueue adds a message to the queue, starting the workers the first time it is called
+func (p *asyncPublisher) enqueue(s *State, job publishJob) C.int {
+	p.Lock()
+	defer p.Unlock()
+	if p.stopped || s.ctx.Err() != nil {
+		return C.PUBLISH_FAILED
+	}
+	p.started.Do(func() {
+		p.running.Add(p.workers)
+		for i := 0; i < p.workers; i++ {
+			go p.work(s)
+		}
+	})
+
+	// NOTE: The workers never touch the flag, so it is cleared here once the queue has drained (even if they are all idle)
+	if p.throttled {
+		if len(p.jobs) > p.lowWatermark {
+			return C.PUBLISH_BACKPRESSURE
+		}
+		p.throttled = false
+	}
+	select {
+	case p.jobs <- job:
+	default:
+		p.throttled = true
+		return C.PUBLISH_BACKPRESSURE
+	}
+	if len(p.jobs) >= p.highWatermark {
+		p.throttled = true
+	}
+	return C.PUBLISH_QUEUED
+}
+
+// work publishes queued messages until the network shuts down
+func (p *asyncPublisher) work(s *State) {
+	defer p.running.Done()
+	for {
+		select {
+		case <-s.ctx.Done():
+			return
+		case job := <-p.jobs:
+			success, start := publish(s, job.topicID, job.message), time.Now()
+			notified := C.bridge_publish_callback(C.int(s.id), C.bool(success), job.callback, job.userData)
+			if job.callback != nil {
+				s.stats.timeCallback(C.CALLBACK_PUBLISH, start)
+			}
+			if !notified {
+				panic("C error!")
+			}
+		}
+	}
+}
+
+// stop rejects any new messages, waits for the workers to finish, then fails whatever is left so every callback is invoked
+// Must only be called once the network's context has been cancelled
+func (p *asyncPublisher) stop(s *State) {
+	p.Lock()
+	p.stopped = true
+	p.Unlock()
+	p.started.Do(func() {}) // The workers can never start once stopped
+	p.running.Wait()
+
+	for {
+		select {
+		case job := <-p.jobs:
+			start := time.Now()
+			C.bridge_publish_callback(C.int(s.id), false, job.callback, job.userData)
+			if job.callback != nil {
+				s.stats.timeCallback(C.CALLBACK_PUBLISH, start)
+			}
+		default:
+			return
+		}
+	}
+}
+
+// configureAsyncPublish sets the queue depth, worker count, and watermarks used by broadcastMessageAsync
+// Returns false if messages have already been published asynchronously (the configuration can no longer be changed)
+//
+//export configureAsyncPublish
+func configureAsyncPublish(nid int, depth int, workers int, highWatermark int, lowWatermark int) bool {
+	s := states.reserve(nid)
+	if s == nil {
+		return false
+	}
+	s.Lock()
+	defer s.Unlock()
+
+	// Claiming the old publisher's start makes sure it can never begin running once it has been replaced
+	if s.publisher != nil {
+		running := true
+		s.publisher.started.Do(func() { running = false })
+		if running {
+			return false
+		}
+	}
+
+	s.publisher = newAsyncPublisher(depth, workers, highWatermark, lowWatermark)
+	return true
+}
+
+// broadcastMessageAsync queues a message to be broadcast to all other peers listening to a topic, the callback is invoked once it has been published
+//
+//export broadcastMessageAsync
+func broadcastMessageAsync(nid int, message *C.char, size C.int, topicID int, callback C.publish_callback, userData unsafe.Pointer) C.int {
+	s := states.get(nid)
+	if s == nil {
+		return C.PUBLISH_FAILED
+	}
+	if t, ok := s.getTopic(topicID); !ok || t.topic == nil {
+		return C.PUBLISH_FAILED
+	}
+
+	job := publishJob{topicID: topicID, message: C.GoBytes(unsafe.Pointer(message), size), callback: callback, userData: userData}
+	// Held while queuing so configureAsyncPublish can't replace the publisher between looking it up and queuing the job (stranding it without workers)
+	s.RLock()
+	defer s.RUnlock()
+	return s.publisher.enqueue(s, job)
+}
+
+// publishQueueDepth returns the number of messages waiting to be published asynchronously
+//
+//export publishQueueDepth
+func publishQueueDepth(nid int) int {
+	if s := states.get(nid); s != nil {
+		return len(s.getPublisher().jobs)
+	}
+	return 0
+}
+
+// outBuffer is a Go allocated message buffer which has been pinned so that C can write into it
+type outBuffer struct {
+	data   []byte
+	pinner runtime.Pinner
+}
+
+// outBuffers holds every buffer handed out by acquireBuffer (and not yet broadcast or released), keyed by its address
+var outBuffers = map[unsafe.Pointer]*outBuffer{}
+var outBuffersMutex sync.Mutex
+
+// takeBuffer removes a buffer handed out by acquireBuffer from outBuffers and unpins it, C may no longer access it afterwards
+func takeBuffer(buffer unsafe.Pointer) *outBuffer {
+	outBuffersMutex.Lock()
+	defer outBuffersMutex.Unlock()
+
+	b, ok := outBuffers[buffer]
+	if !ok {
+		return nil
+	}
+	delete(outBuffers, buffer)
+	b.pinner.Unpin()
+	return b
+}
+
+// acquireBuffer allocates a size byte buffer, owned by Go, which C can fill and then broadcast without it being copied
+//
+//export acquireBuffer
+func acquireBuffer(size C.int) unsafe.Pointer {
+	if size <= 0 {
+		return nil
+	}
+
+	b := &outBuffer{data: make([]byte, size)}
+	buffer := unsafe.Pointer(&b.data[0])
+	b.pinner.Pin(buffer)
+
+	outBuffersMutex.Lock()
+	outBuffers[buffer] = b
+	outBuffersMutex.Unlock()
+	return buffer
+}
+
+// releaseBuffer returns a buffer handed out by acquireBuffer without broadcasting it
+//
+//export releaseBuffer
+func releaseBuffer(buffer unsafe.Pointer) {
+	takeBuffer(buffer)
+}
+
+// broadcastBuffer broadcasts the first size bytes of a buffer handed out by acquireBuffer to all other peers listening to a topic
+// The buffer is handed straight to pubsub (which may hold onto it after this returns), so it is always consumed, even if the broadcast fails
+//
+//export broadcastBuffer
+func broadcastBuffer(nid int, buffer unsafe.Pointer, size C.int, topicID int) bool {
+	b := takeBuffer(buffer)
+	s := states.get(nid)
+	if b == nil || s == nil || size < 0 || int(size) > len(b.data) {
+		return false
+	}
+	return publish(s, topicID, b.data[:size])
+}
+
+// discoveryOptions controls how a network finds its first peers
+type discoveryOptions struct {
+	mode                   C.int           // One of the DISCOVERY_* constants
+	bootstrapPeers         []peer.AddrInfo // Peers to bootstrap the DHT from (or connect to directly when discovering locally)
+	disablePublicBootstrap bool            // Don't bootstrap the DHT from the public IPFS bootstrap peers
+	targetPeers            int             // Discovery keeps searching in the background until this many peers are connected
+}
+
+const (
+	defaultTargetPeers  = 8
+	minDiscoveryBackoff = time.Second // Delay between discovery search rounds after a round connects to a new peer
+	maxDiscoveryBackoff = time.Minute // The delay doubles after each round which doesn't, up to this
+)
+
+// dhtBootstrapPeers returns the peers the DHT should bootstrap from
+func (o discoveryOptions) dhtBootstrapPeers() []peer.AddrInfo {
+	peers := append([]peer.AddrInfo{}, o.bootstrapPeers...)
+	if !o.disablePublicBootstrap {
+		for _, peerAddr := range dht.DefaultBootstrapPeers {
+			if peerinfo, err := peer.AddrInfoFromP2pAddr(peerAddr); err == nil {
+				peers = append(peers, *peerinfo)
+			}
+		}
+	}
+	return peers
+}
+
+// discovery tracks the peers a network's discovery mechanisms have connected to, and how long it took to find them
+type discovery struct {
+	found       chan struct{} // Closed once the first peer has been connected to
+	once        sync.Once
+	started     time.Time
+	targetPeers int
+
+	sync.Mutex
+	peers map[peer.ID]struct{} // Every peer discovery has connected to (some may have since disconnected)
+
+	firstPeer     atomic.Int64 // Nanoseconds from started until the first peer was connected to (-1 until then)
+	targetReached atomic.Int64 // Nanoseconds from started until targetPeers were connected (-1 until then)
+	rounds        atomic.Int32 // The number of DHT (or simulated) search rounds so far
+}
+
+// newDiscovery creates a discovery tracker which considers its target reached once targetPeers are connected
+func newDiscovery(targetPeers int) *discovery {
+	d := &discovery{found: make(chan struct{}), started: time.Now(), targetPeers: targetPeers, peers: make(map[peer.ID]struct{})}
+	d.firstPeer.Store(-1)
+	d.targetReached.Store(-1)
+	return d
+}
+
+// connected notes that a peer has been connected to
+func (d *discovery) connected(s *State, p peer.ID) {
+	elapsed := int64(time.Since(d.started))
+	d.Lock()
+	d.peers[p] = struct{}{}
+	d.Unlock()
+
+	d.once.Do(func() {
+		d.firstPeer.Store(elapsed)
+		close(d.found)
+	})
+	if d.targetReached.Load() < 0 && d.connectedPeers(s) >= d.targetPeers {
+		d.targetReached.CompareAndSwap(-1, elapsed)
+	}
+}
+
+// connectedPeers counts the peers discovery has connected to which are still connected
+func (d *discovery) connectedPeers(s *State) int {
+	d.Lock()
+	defer d.Unlock()
+	count := 0
+	for p := range d.peers {
+		if s.host.Network().Connectedness(p) == network.Connected {
+			count++
+		}
+	}
+	return count
+}
+
+// seconds converts one of the discovery's atomic durations to seconds (keeping -1 as not yet)
+func seconds(nanoseconds int64) C.double {
+	if nanoseconds < 0 {
+		return -1
+	}
+	return C.double(time.Duration(nanoseconds).Seconds())
+}
+
+// discoveryMetrics fills in how long discovery took to find the first peer and the target number of peers
+//
+//export discoveryMetrics
+func discoveryMetrics(nid int, out *C.DiscoveryMetrics) bool {
+	s := states.get(nid)
+	if s == nil || out == nil {
+		return false
+	}
+
+	d := s.discovery
+	out.time_to_first_peer = seconds(d.firstPeer.Load())
+	out.time_to_target_peers = seconds(d.targetReached.Load())
+	out.connected_peers = C.int(d.connectedPeers(s))
+	out.target_peers = C.int(d.targetPeers)
+	out.rounds = C.int(d.rounds.Load())
+	return true
+}
+
+// dialLimits controls how many peers a network dials at once, and how long each dial may take
+type dialLimits struct {
+	concurrency int
+	timeout     time.Duration
+}
+
+// defaultDialLimits keeps a large batch of discovered peers from opening hundreds of connections (and file descriptors) at once
+var defaultDialLimits = dialLimits{concurrency: 8, timeout: 15 * time.Second}
+
+//export configureDialer
+func configureDialer(nid int, concurrency int, timeout float64) bool {
+	if concurrency < 1 || timeout <= 0 {
+		return false
+	}
+	limits := dialLimits{concurrency: concurrency, timeout: time.Duration(timeout * float64(time.Second))}
+	s := states.reserve(nid)
+	if s == nil {
+		return false
+	}
+	s.Lock()
+	s.dialLimits = limits
+	s.Unlock()
+	if s.dialer != nil && s.running.Load() {
+		s.dialer.wake() // A raised limit lets waiting dials start straight away
+	}
+	return true
+}
+
+// dialScheduler caps how many peers a network dials at once and makes sure each peer is only being dialed once at a time
+type dialScheduler struct {
+	sync.Mutex
+	slots   *sync.Cond
+	active  int                      // The number of dials in progress
+	dialing map[peer.ID]*pendingDial // The peers being dialed
+}
+
+// pendingDial is a dial in progress, which other attempts to dial the same peer wait for instead of dialing again
+type pendingDial struct {
+	done    chan struct{} // Closed once the dial has finished
+	success bool          // Whether the dial connected, set before done is closed
+}
+
+// newDialScheduler creates a scheduler with no dials in progress
+func newDialScheduler() *dialScheduler {
+	d := &dialScheduler{dialing: make(map[peer.ID]*pendingDial)}
+	d.slots = sync.NewCond(&d.Mutex)
+	return d
+}
+
+// wake lets waiting dials recheck whether they can start (or if the network is shutting down)
+func (d *dialScheduler) wake() {
+	d.Lock()
+	d.slots.Broadcast()
+	d.Unlock()
+}
+
+// acquire claims a dial slot for a peer, waiting while the concurrency limit is reached
+// If the peer is already being dialed that dial is returned instead (with owner false) so its result can be waited for
+// Returns nil if the network is shutting down
+func (d *dialScheduler) acquire(s *State, ctx context.Context, p peer.ID) (dial *pendingDial, owner bool) {
+	d.Lock()
+	defer d.Unlock()
+	if dial, ok := d.dialing[p]; ok {
+		return dial, false
+	}
+	dial = &pendingDial{done: make(chan struct{})}
+	d.dialing[p] = dial
+	for d.active >= s.getDialLimits().concurrency && ctx.Err() == nil {
+		d.slots.Wait()
+	}
+	if ctx.Err() != nil {
+		delete(d.dialing, p)
+		close(dial.done) // Anyone waiting on us fails too
+		return nil, false
+	}
+	d.active++
+	return dial, true
+}
+
+// release frees the dial slot claimed for a peer, handing the dial's result to anyone waiting on it
+func (d *dialScheduler) release(p peer.ID, success bool) {
+	d.Lock()
+	d.active--
+	dial := d.dialing[p]
+	delete(d.dialing, p)
+	dial.success = success
+	close(dial.done)
+	d.slots.Broadcast()
+	d.Unlock()
+}
+
+// connectToPeer connects to a discovered peer (unless we are already connected to it), noting the connection in d if it succeeds
+// If the peer is already being dialed the result of that dial is returned rather than dialing it twice
+func connectToPeer(s *State, ctx context.Context, p peer.AddrInfo, d *discovery) (connected bool) {
+	if p.ID == s.host.ID() {
+		return false // No self connection
+	}
+	if s.host.Network().Connectedness(p.ID) == network.Connected {
+		d.connected(s, p.ID)
+		return true
+	}
+
+	dial, owner := s.dialer.acquire(s, ctx, p.ID)
+	if dial == nil {
+		return false
+	}
+	if !owner {
+		select {
+		case <-dial.done:
+			return dial.success
+		case <-ctx.Done():
+			return false
+		}
+	}
+	defer func() { s.dialer.release(p.ID, connected) }()
+
+	ctx, cancel := context.WithTimeout(ctx, s.getDialLimits().timeout)
+	defer cancel()
+	if err := s.host.Connect(ctx, p); err != nil {
+		s.stats.failedDials.Add(1)
+		if logEnabled(s, C.LOG_DEBUG) {
+			logf(s, C.LOG_DEBUG, "Failed connecting to %s error: %v", p.ID, err)
+		}
+		return false
+	}
+	s.stats.dials.Add(1)
+	if logEnabled(s, C.LOG_DEBUG) {
+		logf(s, C.LOG_DEBUG, "Connected to: %s", p.ID)
+	}
+	d.connected(s, p.ID)
+	return true
+}
+
+// connectToPeers connects to a batch of discovered peers, dialing those with the lowest previously measured round trip time first
+// Duplicates and peers we are already connected to are skipped, and at most the dial concurrency limit of workers are used
+func connectToPeers(s *State, ctx context.Context, candidates []peer.AddrInfo, d *discovery) {
+	seen := make(map[peer.ID]struct{}, len(candidates))
+	pending := make([]peer.AddrInfo, 0, len(candidates))
+	for _, p := range candidates {
+		if _, ok := seen[p.ID]; ok || p.ID == s.host.ID() {
+			continue
+		}
+		seen[p.ID] = struct{}{}
+		if s.host.Network().Connectedness(p.ID) == network.Connected {
+			d.connected(s, p.ID)
+			continue
+		}
+		pending = append(pending, p)
+	}
+
+	// Peers whose latency has never been measured go last
+	latencies := make(map[peer.ID]time.Duration, len(pending))
+	for _, p := range pending {
+		latencies[p.ID] = s.host.Peerstore().LatencyEWMA(p.ID)
+	}
+	sort.SliceStable(pending, func(i, j int) bool {
+		a, b := latencies[pending[i].ID], latencies[pending[j].ID]
+		if a == 0 || b == 0 {
+			return a != 0 && b == 0
+		}
+		return a < b
+	})
+
+	workers := s.getDialLimits().concurrency
+	if workers > len(pending) {
+		workers = len(pending)
+	}
+	var next atomic.Int32
+	var wg sync.WaitGroup
+	for i := 0; i < workers; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for i := int(next.Add(1)) - 1; i < len(pending) && ctx.Err() == nil; i = int(next.Add(1)) - 1 {
+				connectToPeer(s, ctx, pending[i], d)
+			}
+		}()
+	}
+	wg.Wait()
+}
+
+// connect dials a peer directly given its multiaddr (which must include its /p2p/ peer ID)
+// If it is the first peer the network has connected to, discovery finishes (and the connected callback fires) immediately
+func (s *State) connect(address string) bool {
+	info, err := peer.AddrInfoFromString(address)
+	if err != nil {
+		if logEnabled(s, C.LOG_WARNING) {
+			logf(s, C.LOG_WARNING, "Invalid peer address %s error: %v", address, err)
+		}
+		return false
+	}
+
+	return connectToPeer(s, s.ctx, *info, s.discovery)
+}
+
+// connectPeer connects directly to a peer given its multiaddr
+//
+//export connectPeer
+func connectPeer(nid int, address string) bool {
+	s := states.get(nid)
+	if s == nil {
+		return false
+	}
+	return s.connect(address)
+}
+
+// connectPeers connects directly to several peers (in parallel, up to the dial concurrency limit) given their multiaddrs, optionally recording whether each connection succeeded in results
+//
+//export connectPeers
+func connectPeers(nid int, addresses **C.char, count C.int, results *C.bool) C.int {
+	s := states.get(nid)
+	if s == nil || addresses == nil || count <= 0 {
+		return 0
+	}
+
+	var statuses []C.bool
+	if results != nil {
+		statuses = unsafe.Slice(results, count)
+	}
+
+	var connected atomic.Int32
+	var wg sync.WaitGroup
+	for i, address := range unsafe.Slice(addresses, count) {
+		wg.Add(1)
+		go func(i int, address string) {
+			defer wg.Done()
+			success := s.connect(address)
+			if success {
+				connected.Add(1)
+			}
+			if statuses != nil {
+				statuses[i] = C.bool(success)
+			}
+		}(i, C.GoString(address))
+	}
+	wg.Wait()
+	return C.int(connected.Load())
+}
+
+// initDHT initializes the DHT used to find peers, returning nil (after reporting the error) if it can't be started
+func initDHT(s *State, ctx context.Context, bootstrapPeers []peer.AddrInfo) *dht.IpfsDHT {
+	// Start a DHT, for use in peer discovery. We can't just make a new DHT
+	// client because we want each peer to maintain its own local copy of the
+	// DHT, so that the bootstrapping node of the DHT can go down without
+	// inhibiting future peer discovery.
+	kademliaDHT, err := dht.New(ctx, s.host, dht.BootstrapPeers(bootstrapPeers...))
+	if err != nil {
+		notifyError(s, C.ERROR_DISCOVERY, "Failed to create the DHT: "+err.Error())
+		return nil
+	}
+	if err = kademliaDHT.Bootstrap(ctx); err != nil {
+		kademliaDHT.Close()
+		notifyError(s, C.ERROR_DISCOVERY, "Failed to bootstrap the DHT: "+err.Error())
+		return nil
+	}
+	var wg sync.WaitGroup
+	for _, peerinfo := range bootstrapPeers {
+		wg.Add(1)
+		go func(peerinfo peer.AddrInfo) {
+			defer wg.Done()
+			if err := s.host.Connect(ctx, peerinfo); err != nil && logEnabled(s, C.LOG_WARNING) {
+				logf(s, C.LOG_WARNING, "Bootstrap warning: %v", err)
+			}
+		}(peerinfo)
+	}
+	wg.Wait()
+
+	return kademliaDHT
+}
+
+// findDHTPeers advertises the network on the DHT and connects to anyone else advertising it
+// It keeps searching in the background (backing off exponentially while rounds turn up nothing new) until shutdown, staying idle while the target number of peers are connected
+func findDHTPeers(s *State, ctx context.Context, advertisingTopic string, bootstrapPeers []peer.AddrInfo, d *discovery) {
+	kademliaDHT := initDHT(s, ctx, bootstrapPeers)
+	if kademliaDHT == nil {
+		return
+	}
+	s.Lock()
+	if !s.running.Load() {
+		s.Unlock()
+		kademliaDHT.Close()
+		return
+	}
+	s.dht = kademliaDHT
+	s.Unlock()
 	routingDiscovery := drouting.NewRoutingDiscovery(kademliaDHT)
 	dutil.Advertise(ctx, routingDiscovery, advertisingTopic)
 
-	// Look for others who have announced and attempt to connect to them
-	anyConnected := false
-	for !anyConnected {
-		select {
-		case <-ctx.Done():
-			panic("Failed to find peers!")
-		default:
-			fmt.Println("Searching for peers...")
-			peerChan, err := routingDiscovery.FindPeers(ctx, advertisingTopic)
-			if err != nil {
-				panic(err)
-			}
-			var wg sync.WaitGroup
-			for peer := range peerChan {
-				wg.Add(1)
-				go func() {
-					defer wg.Done()
-					if peer.ID == h.ID() {
-						return // No self connection
-					}
-					err := h.Connect(ctx, peer)
-					if err != nil {
-						if states[nid].verbose {
-							fmt.Println("Failed connecting to ", string(peer.ID), ", error:", err)
-						}
-					} else {
-						if states[nid].verbose {
-							fmt.Println("Connected to:", string(peer.ID))
-						}
-						anyConnected = true
-					}
-				}()
+	// Look for others who have announced and attempt to connect to them
+	searchRounds(s, ctx, d, func(int) error {
+		if logEnabled(s, C.LOG_DEBUG) {
+			logf(s, C.LOG_DEBUG, "Searching for peers...")
+		}
+		peerChan, err := routingDiscovery.FindPeers(ctx, advertisingTopic)
+		if err != nil {
+			if ctx.Err() == nil {
+				notifyError(s, C.ERROR_DISCOVERY, "Failed to search the DHT for peers: "+err.Error())
+			}
+			return err
+		}
+
+		var candidates []peer.AddrInfo
+		for p := range peerChan {
+			candidates = append(candidates, p)
+		}
+		connectToPeers(s, ctx, candidates, d)
+		return nil
+	})
+}
+
+// searchRounds runs discovery search rounds until shutdown, each is told how many more peers are wanted
+// Rounds back off exponentially while they turn up nothing new, and are skipped while the target number of peers are connected
+func searchRounds(s *State, ctx context.Context, d *discovery, round func(wanted int) error) {
+	backoff := minDiscoveryBackoff
+	for {
+		wait := minDiscoveryBackoff // Only poll the peer count while the target is reached
+		if before := d.connectedPeers(s); before < d.targetPeers {
+			d.rounds.Add(1)
+			if err := round(d.targetPeers - before); err == nil && d.connectedPeers(s) > before {
+				backoff = minDiscoveryBackoff
+			} else if backoff *= 2; backoff > maxDiscoveryBackoff {
+				backoff = maxDiscoveryBackoff
+			}
+			wait = backoff
+		}
+
+		select {
+		case <-ctx.Done():
+			return
+		case <-time.After(wait):
+		}
+	}
+}
+
+// mdnsNotifee connects to the peers mDNS finds on the local network
+type mdnsNotifee struct {
+	s *State
+	d *discovery
+}
+
+// HandlePeerFound is called by mDNS whenever it finds a peer
+func (n mdnsNotifee) HandlePeerFound(p peer.AddrInfo) {
+	n.s.spawn(func() { connectToPeer(n.s, n.s.ctx, p, n.d) })
+}
+
+// mdnsServiceName derives a valid mDNS service name from a discovery topic (which may contain characters mDNS doesn't allow)
+func mdnsServiceName(advertisingTopic string) string {
+	hash := sha256.Sum256([]byte(advertisingTopic))
+	return "simplep2p-" + hex.EncodeToString(hash[:8])
+}
+
+// findLocalPeers connects directly to the bootstrap peers and starts looking for peers on the local network using mDNS
+// Inside a simulation the simulation's other networks are searched instead (until shutdown)
+func findLocalPeers(s *State, ctx context.Context, advertisingTopic string, bootstrapPeers []peer.AddrInfo, d *discovery) {
+	s.spawn(func() { connectToPeers(s, ctx, bootstrapPeers, d) })
+	if s.simulation != nil {
+		findSimulatedPeers(s, ctx, d)
+		return
+	}
+
+	service := mdns.NewMdnsService(s.host, mdnsServiceName(advertisingTopic), mdnsNotifee{s: s, d: d})
+	if err := service.Start(); err != nil {
+		logf(s, C.LOG_ERROR, "Failed to start mDNS discovery: %v", err)
+		return
+	}
+
+	// The service keeps running (so peers which start later are still found) until shutdown
+	s.Lock()
+	defer s.Unlock()
+	if !s.running.Load() {
+		service.Close()
+		return
+	}
+	s.mdns = service
+}
+
+// discoverPeers starts discovering peers (in the background, until shutdown) and fires the connected callback once the first one is connected to
+// If none is found within the connection timeout an error is reported, but discovery carries on
+func discoverPeers(s *State, advertisingTopic string, options discoveryOptions) {
+	d := s.discovery
+	if options.mode != C.DISCOVERY_DHT {
+		s.spawn(func() { findLocalPeers(s, s.ctx, advertisingTopic, options.bootstrapPeers, d) })
+	}
+	if options.mode != C.DISCOVERY_LOCAL {
+		s.spawn(func() { findDHTPeers(s, s.ctx, advertisingTopic, options.dhtBootstrapPeers(), d) })
+	}
+
+	timeout := time.NewTimer(time.Duration(s.connectionTimeout * float64(time.Second)))
+	defer timeout.Stop()
+	for {
+		select {
+		case <-d.found:
+			logf(s, C.LOG_INFO, "Peer discovery complete!")
+			notifyNetwork(s, C.EVENT_CONNECTED, s.getCallbacks().connected)
+			return
+		case <-s.ctx.Done():
+			return // The network was shutdown before any peers were found
+		case <-timeout.C:
+			notifyError(s, C.ERROR_DISCOVERY_TIMEOUT, "Failed to find any peers within the connection timeout, still searching...")
+		}
+	}
+}
+
+// linkOptions describes a link between two simulated networks
+type linkOptions struct {
+	latency   time.Duration
+	bandwidth float64 // Bytes per second (0 for unlimited)
+	loss      float64 // Fraction of messages lost crossing the link
+}
+
+// mocknet converts the options mocknet itself simulates (it has no notion of loss)
+func (o linkOptions) mocknet() mocknet.LinkOptions {
+	return mocknet.LinkOptions{Latency: o.latency, Bandwidth: o.bandwidth}
+}
+
+// simulationMember is a network running inside a simulation
+type simulationMember struct {
+	host host.Host
+	rng  *mrand.Rand // Picks which other members simulated discovery connects to (seeded by the order the member joined in)
+}
+
+// simulation is an in-process network (backed by libp2p's mocknet) which networks can be started inside instead of on real sockets
+// Identities, discovery, and message loss are all driven by the seed, so the same sequence of calls produces the same simulation
+type simulation struct {
+	sync.Mutex
+	net      mocknet.Mocknet
+	seed     int64
+	defaults linkOptions
+	keys     *mrand.Rand // Generates the identities of members which weren't given one
+	joined   int64       // The number of networks which have joined (including those which have since left)
+	members  []*simulationMember
+	loss     map[[2]peer.ID]float64     // Per link overrides of the default loss (keyed by the smaller peer ID first)
+	lossRngs map[[2]peer.ID]*mrand.Rand // One per direction of each link (keyed by receiver then sender)
+	indices  map[peer.ID]int64
+}
+
+// newSimulation creates an empty simulation whose links default to the given options
+func newSimulation(defaults linkOptions, seed int64) *simulation {
+	sim := &simulation{
+		net:      mocknet.New(),
+		seed:     seed,
+		defaults: defaults,
+		keys:     mrand.New(mrand.NewSource(seed)),
+		loss:     make(map[[2]peer.ID]float64),
+		lossRngs: make(map[[2]peer.ID]*mrand.Rand),
+		indices:  make(map[peer.ID]int64),
+	}
+	sim.net.SetLinkDefaults(defaults.mocknet())
+	return sim
+}
+
+// generateKey derives the next member's identity from the seed
+// Ed25519 keys are used since (unlike ECDSA) their generation is fully determined by the random stream
+func (sim *simulation) generateKey() []byte {
+	sim.Lock()
+	defer sim.Unlock()
+	privKey, _, err := crypto.GenerateEd25519Key(sim.keys)
+	if err != nil {
+		panic(err)
+	}
+
+	keyBytes, err := crypto.MarshalPrivateKey(privKey)
+	if err != nil {
+		panic(err)
+	}
+	return keyBytes
+}
+
+// join creates a host inside the simulation and links it to every other member
+func (sim *simulation) join(key crypto.PrivKey) (host.Host, error) {
+	sim.Lock()
+	defer sim.Unlock()
+	index := sim.joined
+	// The address is only used to identify the member (the discard prefix makes sure it can never be reached outside of the simulation)
+	address, err := ma.NewMultiaddr(fmt.Sprintf("/ip6/100::%x/tcp/4242", index+1))
+	if err != nil {
+		return nil, err
+	}
+	h, err := sim.net.AddPeer(key, address)
+	if err != nil {
+		return nil, err
+	}
+	for _, m := range sim.members {
+		if _, err := sim.net.LinkPeers(h.ID(), m.host.ID()); err != nil {
+			return nil, err
+		}
+	}
+
+	sim.joined++
+	sim.indices[h.ID()] = index
+	sim.members = append(sim.members, &simulationMember{host: h, rng: mrand.New(mrand.NewSource(sim.seed + index))})
+	return h, nil
+}
+
+// leave removes a member so that simulated discovery no longer offers it
+func (sim *simulation) leave(p peer.ID) {
+	sim.Lock()
+	defer sim.Unlock()
+	for i, m := range sim.members {
+		if m.host.ID() == p {
+			sim.members = append(sim.members[:i], sim.members[i+1:]...)
+			return
+		}
+	}
+}
+
+// linkKey orders a link's peers so that both directions share the same key
+func linkKey(a, b peer.ID) [2]peer.ID {
+	if b < a {
+		a, b = b, a
+	}
+	return [2]peer.ID{a, b}
+}
+
+// setLink changes the options of the link between two members
+func (sim *simulation) setLink(a, b peer.ID, o linkOptions) bool {
+	sim.Lock()
+	defer sim.Unlock()
+	links := sim.net.LinksBetweenPeers(a, b)
+	for _, l := range links {
+		l.SetOptions(o.mocknet())
+	}
+	sim.loss[linkKey(a, b)] = o.loss
+	return len(links) > 0
+}
+
+// drop decides if a message sent from one member to another is lost crossing their link
+func (sim *simulation) drop(to, from peer.ID) bool {
+	sim.Lock()
+	defer sim.Unlock()
+	loss, ok := sim.loss[linkKey(to, from)]
+	if !ok {
+		loss = sim.defaults.loss
+	}
+	if loss <= 0 {
+		return false
+	}
+
+	direction := [2]peer.ID{to, from}
+	rng := sim.lossRngs[direction]
+	if rng == nil {
+		rng = mrand.New(mrand.NewSource(sim.seed ^ (sim.indices[to]+1)<<32 ^ (sim.indices[from] + 1)))
+		sim.lossRngs[direction] = rng
+	}
+	return rng.Float64() < loss
+}
+
+// inspector drops published messages arriving at a member according to the loss of the link they crossed
+// Lost messages are removed from the incoming RPC before pubsub has seen them (control messages always get through), so they may
+// still arrive by another route or be requested again through gossip, just like a message lost on one link of a real network
+func (sim *simulation) inspector(self peer.ID) func(peer.ID, *pubsub.RPC) error {
+	return func(from peer.ID, rpc *pubsub.RPC) error {
+		kept := rpc.Publish[:0]
+		for _, m := range rpc.Publish {
+			if !sim.drop(self, from) {
+				kept = append(kept, m)
 			}
-			wg.Wait()
 		}
+		rpc.Publish = kept
+		return nil
+	}
+}
+
+// neighbours picks up to count other members (in a seeded random order) for simulated discovery to connect to
+func (sim *simulation) neighbours(self peer.ID, count int) []peer.AddrInfo {
+	sim.Lock()
+	defer sim.Unlock()
+	var rng *mrand.Rand
+	others := make([]peer.AddrInfo, 0, len(sim.members))
+	for _, m := range sim.members {
+		if m.host.ID() == self {
+			rng = m.rng
+		} else {
+			others = append(others, peer.AddrInfo{ID: m.host.ID(), Addrs: m.host.Addrs()})
+		}
+	}
+	if rng == nil {
+		return nil
+	}
+
+	rng.Shuffle(len(others), func(i, j int) { others[i], others[j] = others[j], others[i] })
+	if count < len(others) {
+		others = others[:count]
+	}
+	return others
+}
+
+// simulationTable maps simulation IDs to simulations, IDs start at 1 so that 0 can mean no simulation
+type simulationTable struct {
+	sync.Mutex
+	simulations map[int]*simulation
+	next        int
+}
+
+var simulations = simulationTable{simulations: make(map[int]*simulation), next: 1}
+
+// get returns a simulation, or nil if the ID isn't valid
+func (t *simulationTable) get(sid int) *simulation {
+	t.Lock()
+	defer t.Unlock()
+	return t.simulations[sid]
+}
+
+// createSimulation creates an in-process simulation which networks can be initialized inside of instead of on real sockets
+//
+//export createSimulation
+func createSimulation(latency float64, bandwidth float64, loss float64, seed int64) int {
+	sim := newSimulation(linkOptions{latency: time.Duration(latency * float64(time.Second)), bandwidth: bandwidth, loss: loss}, seed)
+	simulations.Lock()
+	defer simulations.Unlock()
+	sid := simulations.next
+	simulations.next++
+	simulations.simulations[sid] = sim
+	return sid
+}
+
+// setLinkOptions changes the latency, bandwidth, and loss of the link between two networks in the same simulation
+//
+//export setLinkOptions
+func setLinkOptions(sid int, a int, b int, latency float64, bandwidth float64, loss float64) bool {
+	sim := simulations.get(sid)
+	sa, sb := states.get(a), states.get(b)
+	if sim == nil || sa == nil || sb == nil || sa.simulation != sim || sb.simulation != sim || a == b {
+		return false
 	}
+	return sim.setLink(sa.host.ID(), sb.host.ID(), linkOptions{latency: time.Duration(latency * float64(time.Second)), bandwidth: bandwidth, loss: loss})
+}
+
+// destroySimulation frees a simulation, every network inside of it should be shutdown first
+//
+//export destroySimulation
+func destroySimulation(sid int) {
+	simulations.Lock()
+	sim := simulations.simulations[sid]
+	delete(simulations.simulations, sid)
+	simulations.Unlock()
+	if sim != nil {
+		sim.net.Close()
+	}
+}
+
+// findSimulatedPeers stands in for mDNS inside a simulation (which has no sockets), treating the simulation's other networks as the local network
+func findSimulatedPeers(s *State, ctx context.Context, d *discovery) {
+	searchRounds(s, ctx, d, func(wanted int) error {
+		connectToPeers(s, ctx, s.simulation.neighbours(s.host.ID(), wanted), d)
+		return nil
+	})
+}
+
+// peerEvent is a peer joining or leaving one of our topics, or (if closed is set) a topic no longer being watched
+type peerEvent struct {
+	topicID int
+	peer    peer.ID
+	join    bool
+	closed  bool
+}
+
+// peerEventQueue hands peer events from the topic watchers to trackPeers
+// Pushing never blocks, so a topic can be left (and its watcher stopped) even from inside a peer callback
+type peerEventQueue struct {
+	sync.Mutex
+	pending []peerEvent
+	ready   chan struct{} // Signaled whenever pending becomes non-empty
+}
+
+// newPeerEventQueue creates an empty peerEventQueue
+func newPeerEventQueue() *peerEventQueue {
+	return &peerEventQueue{ready: make(chan struct{}, 1)}
+}
+
+// push adds an event to the queue
+func (q *peerEventQueue) push(e peerEvent) {
+	q.Lock()
+	q.pending = append(q.pending, e)
+	q.Unlock()
+	select {
+	case q.ready <- struct{}{}:
+	default: // Already signaled
+	}
+}
 
-	fmt.Println("Peer discovery complete!")
-	C.bridge_void_callback(C.int(nid), connectedCallbacks[nid])
+// take removes every queued event, reusing the storage of the previously taken batch
+func (q *peerEventQueue) take(reuse []peerEvent) []peerEvent {
+	q.Lock()
+	defer q.Unlock()
+	out := q.pending
+	q.pending = reuse[:0]
+	return out
 }
 
-// trackPeers tracks connected and disconnected peers and fires events when peers connect or disconnect
-func trackPeers(nid int, ctx context.Context) {
-	connectedPeers := make(map[peer.ID]struct{})
+// watchTopic forwards a topic's peer join and leave events to trackPeers until ctx is cancelled
+// The handler is cancelled (so the topic can be closed) before done is closed
+func watchTopic(ctx context.Context, s *State, topicID int, handler *pubsub.TopicEventHandler, done chan<- struct{}) {
+	defer close(done)
+	defer s.peerEvents.push(peerEvent{topicID: topicID, closed: true})
+	defer handler.Cancel()
 
 	for {
-		select {
-		case <-ctx.Done():
+		e, err := handler.NextPeerEvent(ctx)
+		if err != nil {
 			return
-		case <-time.After(time.Second):
-			peers := make([]peer.ID, 0)
-			newPeers := make([]peer.ID, 0)
-			disconnectedPeers := make([]peer.ID, 0)
+		}
+		s.peerEvents.push(peerEvent{topicID: topicID, peer: e.Peer, join: e.Type == pubsub.PeerJoin})
+	}
+}
 
-			for _, topic := range states[nid].ps.GetTopics() {
-				peers = append(peers, states[nid].ps.ListPeers(topic)...)
-			}
+// peerHandles interns the IDs of the peers a network has seen into dense handles, so C can index per peer state with flat arrays instead of hashing IDs
+// Handles are never reused while the network is running, and each ID is mirrored into C memory (freed on shutdown) so it can be looked up without allocating
+// Only peers the network actually hears from (through peer events or messages) are interned, so the table grows with the number of distinct peers seen and is only reclaimed on shutdown
+type peerHandles struct {
+	sync.RWMutex
+	ids     []*C.char
+	sizes   []C.int
+	handles map[peer.ID]int
+}
 
-			// Check for new peers
-			for _, p := range peers {
-				if _, ok := connectedPeers[p]; !ok {
-					connectedPeers[p] = struct{}{}
-					newPeers = append(newPeers, p)
-				}
-			}
+// newPeerHandles creates an empty interning table
+func newPeerHandles() *peerHandles {
+	return &peerHandles{handles: make(map[peer.ID]int)}
+}
 
-			// Check for disconnected peers
-			for p := range connectedPeers {
-				if !containsPeer(peers, p) {
-					delete(connectedPeers, p)
-					disconnectedPeers = append(disconnectedPeers, p)
-				}
-			}
+// intern returns the handle of a peer, assigning it the next one if it hasn't been seen before
+func (h *peerHandles) intern(p peer.ID) int {
+	h.RLock()
+	handle, ok := h.handles[p]
+	h.RUnlock()
+	if ok {
+		return handle
+	}
 
-			for _, peerID := range newPeers {
-				c := C.CString(string(peerID))
-				defer C.free(unsafe.Pointer(c))
-				if !C.bridge_peer_callback(C.int(nid), c, peerconnectedCallbacks[nid]) {
-					panic("C error!")
-				}
+	h.Lock()
+	defer h.Unlock()
+	if handle, ok = h.handles[p]; ok {
+		return handle // Interned while we were waiting for the lock
+	}
+	if h.handles == nil {
+		return -1 // Freed by shutdown
+	}
+	handle = len(h.ids)
+	h.ids = append(h.ids, (*C.char)(C.CBytes(append([]byte(p), 0))))
+	h.sizes = append(h.sizes, C.int(len(p)))
+	h.handles[p] = handle
+	return handle
+}
+
+// find returns the handle of a peer which has already been interned, or -1 if it hasn't been seen
+func (h *peerHandles) find(p peer.ID) int {
+	h.RLock()
+	defer h.RUnlock()
+	if handle, ok := h.handles[p]; ok {
+		return handle
+	}
+	return -1
+}
+
+// free releases the C copies of the interned IDs
+func (h *peerHandles) free() {
+	h.Lock()
+	defer h.Unlock()
+	for _, id := range h.ids {
+		C.free(unsafe.Pointer(id))
+	}
+	h.ids, h.sizes, h.handles = nil, nil, nil
+}
+
+// peerID looks up the ID of an interned peer handle, the returned string stays valid until the network is shutdown
+//
+//export peerID
+func peerID(nid int, handle int, size *C.int) *C.char {
+	s := states.get(nid)
+	if s == nil {
+		return nil
+	}
+
+	s.handles.RLock()
+	defer s.handles.RUnlock()
+	if handle < 0 || handle >= len(s.handles.ids) {
+		return nil
+	}
+	if size != nil {
+		*size = s.handles.sizes[handle]
+	}
+	return s.handles.ids[handle]
+}
+
+// peerHandle returns the handle of a peer given its ID
+// Never interns, otherwise C could grow the table without bound by asking about arbitrary strings
+//
+//export peerHandle
+func peerHandle(nid int, id string) int {
+	s := states.get(nid)
+	if s == nil || len(id) == 0 {
+		return -1
+	}
+	return s.handles.find(peer.ID(id))
+}
+
+// topicPeers is the set of peers in one of our topics
+type topicPeers struct {
+	peers   map[peer.ID]struct{}
+	version int64 // Incremented every time the set changes
+}
+
+// peerTracker holds the peers in each of a network's topics, as reported by the topic watchers
+// Only trackPeers modifies it, the lock lets other threads take snapshots
+type peerTracker struct {
+	sync.RWMutex
+	topics map[int]*topicPeers
+	counts map[peer.ID]int // The number of tracked topics each peer is in
+}
+
+// newPeerTracker creates a tracker without any topics
+func newPeerTracker() *peerTracker {
+	return &peerTracker{topics: make(map[int]*topicPeers), counts: make(map[peer.ID]int)}
+}
+
+// apply moves a peer into or out of a topic, duplicate events are ignored
+// Returns whether the peer is now in its first topic (connected) or has just left its last one (disconnected)
+func (t *peerTracker) apply(topicID int, p peer.ID, join bool) (connected bool, disconnected bool) {
+	t.Lock()
+	defer t.Unlock()
+	set := t.topics[topicID]
+	if set == nil {
+		set = &topicPeers{peers: make(map[peer.ID]struct{})}
+		t.topics[topicID] = set
+	}
+	if _, in := set.peers[p]; in == join {
+		return false, false
+	}
+	set.version++
+
+	if join {
+		set.peers[p] = struct{}{}
+		t.counts[p]++
+		return t.counts[p] == 1, false
+	}
+	delete(set.peers, p)
+	if t.counts[p]--; t.counts[p] > 0 {
+		return false, false
+	}
+	delete(t.counts, p)
+	return false, true
+}
+
+// members lists the peers in a topic
+func (t *peerTracker) members(topicID int) []peer.ID {
+	t.RLock()
+	defer t.RUnlock()
+	set := t.topics[topicID]
+	if set == nil {
+		return nil
+	}
+	out := make([]peer.ID, 0, len(set.peers))
+	for p := range set.peers {
+		out = append(out, p)
+	}
+	return out
+}
+
+// size counts the peers in a topic
+func (t *peerTracker) size(topicID int) int {
+	t.RLock()
+	defer t.RUnlock()
+	if set := t.topics[topicID]; set != nil {
+		return len(set.peers)
+	}
+	return 0
+}
+
+// peerCount counts the peers sharing at least one topic with us
+func (t *peerTracker) peerCount() int {
+	t.RLock()
+	defer t.RUnlock()
+	return len(t.counts)
+}
+
+// forget stops tracking a topic (whose peers must have all been moved out of it)
+func (t *peerTracker) forget(topicID int) {
+	t.Lock()
+	delete(t.topics, topicID)
+	t.Unlock()
+}
+
+// trackPeers turns the peer events of every topic into connected and disconnected events
+// A peer counts as connected while it shares at least one topic with us, so it is only reported once no matter how many topics it joins
+func trackPeers(s *State) {
+	var events []peerEvent
+
+	// update moves a peer into or out of a topic, reporting it if that changes whether it is connected
+	update := func(topicID int, p peer.ID, join bool) {
+		connected, disconnected := s.peers.apply(topicID, p, join)
+		callbacks := s.getCallbacks()
+		if connected && !notifyPeer(s, C.EVENT_PEER_CONNECTED, p, callbacks.peerConnected) {
+			panic("C error!")
+		}
+		if disconnected && !notifyPeer(s, C.EVENT_PEER_DISCONNECTED, p, callbacks.peerDisconnected) {
+			panic("C error!")
+		}
+	}
+
+	for {
+		select {
+		case <-s.ctx.Done():
+			return
+		case <-s.peerEvents.ready:
+		}
+
+		events = s.peerEvents.take(events)
+		for _, e := range events {
+			if s.ctx.Err() != nil {
+				return
+			}
+			if !e.closed {
+				update(e.topicID, e.peer, e.join)
+				continue
 			}
 
-			for _, peerID := range disconnectedPeers {
-				c := C.CString(string(peerID))
-				defer C.free(unsafe.Pointer(c))
-				if !C.bridge_peer_callback(C.int(nid), c, peerDisconnectedCallbacks[nid]) {
-					panic("C error!")
-				}
+			// We left the topic, so its peers no longer share it with us
+			for _, p := range s.peers.members(e.topicID) {
+				update(e.topicID, p, false)
 			}
+			s.peers.forget(e.topicID)
 		}
 	}
 }
 
-// containsPeer checks if a peer exists in a list of peers
-func containsPeer(peers []peer.ID, target peer.ID) bool {
-	for _, p := range peers {
-		if p == target {
-			return true
+// listPeers copies the IDs of the peers in a topic into buf (each followed by a null terminator) in a single call
+// offsets (which must have room for maxPeers + 1 entries) is filled with where each ID starts, followed by where the last one ends
+// Returns the number of peers, or minus the number of peers if they don't all fit in the provided buffers
+//
+//export listPeers
+func listPeers(nid int, topicID int, buf *C.char, bufSize C.int, offsets *C.int, maxPeers C.int) C.int {
+	s := states.get(nid)
+	if s == nil {
+		return 0
+	}
+	if _, ok := s.getTopic(topicID); !ok {
+		return 0
+	}
+
+	s.peers.RLock()
+	defer s.peers.RUnlock()
+	set := s.peers.topics[topicID]
+	if set == nil {
+		return 0
+	}
+	count := len(set.peers)
+	if count > int(maxPeers) || offsets == nil {
+		return -C.int(count)
+	}
+
+	out := unsafe.Slice((*byte)(unsafe.Pointer(buf)), bufSize)
+	starts := unsafe.Slice(offsets, count+1)
+	used, i := 0, 0
+	for p := range set.peers {
+		if used+len(p)+1 > len(out) {
+			return -C.int(count)
 		}
+		starts[i] = C.int(used)
+		used += copy(out[used:], p)
+		out[used] = 0
+		used++
+		i++
 	}
-	return false
+	starts[i] = C.int(used)
+	return C.int(count)
+}
+
+// peerListVersion returns a counter which changes every time the peers in a topic change, or -1 if the topic isn't valid
+//
+//export peerListVersion
+func peerListVersion(nid int, topicID int) int64 {
+	s := states.get(nid)
+	if s == nil {
+		return -1
+	}
+	if _, ok := s.getTopic(topicID); !ok {
+		return -1
+	}
+
+	s.peers.RLock()
+	defer s.peers.RUnlock()
+	if set := s.peers.topics[topicID]; set != nil {
+		return set.version
+	}
+	return 0
+}
+
+// messageBuffer is a block of C memory that incoming messages are packed into before being handed to C
+// It is reused for every message a reciever gets and only ever grows, so once it is large enough messages are delivered without any allocations
+type messageBuffer struct {
+	data     unsafe.Pointer
+	capacity int
+	used     int
+}
+
+// reserve makes sure the buffer can hold at least size bytes, discarding anything currently packed into it
+func (b *messageBuffer) reserve(size int) {
+	b.used = 0
+	if size <= b.capacity {
+		return
+	}
+
+	C.free(b.data)
+	b.data = C.malloc(C.size_t(size))
+	b.capacity = size
+}
+
+// release frees the underlying C memory
+func (b *messageBuffer) release() {
+	C.free(b.data)
+	b.data = nil
+	b.capacity = 0
+	b.used = 0
+}
+
+// packField copies a field into the buffer (null terminated so C can still treat it as a string) and returns a pointer to it and its length
+func packField[T ~string | ~[]byte](b *messageBuffer, field T) (*C.char, C.int) {
+	start := b.used
+	dst := unsafe.Slice((*byte)(b.data), b.capacity)
+	copy(dst[start:], field)
+	dst[start+len(field)] = 0
+	b.used += len(field) + 1
+	return (*C.char)(unsafe.Add(b.data, start)), C.int(len(field))
+}
+
+// packedMessageSize calculates how many bytes are needed to pack every field of a message (including null terminators)
+func packedMessageSize(m *pubsub.Message) int {
+	return len(m.Message.From) + len(m.Message.Data) + len(m.Message.Seqno) + len(*m.Message.Topic) +
+		len(m.Message.Signature) + len(m.Message.Key) + len(m.ID) + len(m.ReceivedFrom) + 8
+}
+
+// packMessage copies every field of a message into the buffer and fills out the C view of it
+// data is the message's payload (with any latency header removed)
+func packMessage(nid int, localID peer.ID, handles *peerHandles, b *messageBuffer, m *pubsub.Message, data []byte, msg *C.Message) {
+	msg.network = C.int(nid)
+	msg.local = C.bool(m.ReceivedFrom == localID)
+	msg.recieved_from_handle = C.int(handles.intern(m.ReceivedFrom))
+	msg.from, msg.from_size = packField(b, m.Message.From)
+	msg.data, msg.data_size = packField(b, data)
+	msg.seqno, msg.seqno_size = packField(b, m.Message.Seqno)
+	msg.topic, msg.topic_size = packField(b, *m.Message.Topic)
+	msg.signature, msg.signature_size = packField(b, m.Message.Signature)
+	msg.key, msg.key_size = packField(b, m.Message.Key)
+	msg.id, msg.id_size = packField(b, m.ID)
+	msg.recieved_from, msg.recieved_from_size = packField(b, m.ReceivedFrom)
 }
 
-// reciever receives messages from a subscription
-func reciever(nid int, ctx context.Context, sub *pubsub.Subscription) {
+// subscriptionBufferSize is the number of messages which can be waiting for a reciever before the pubsub subscription starts buffering them
+const subscriptionBufferSize = 32
+
+// pumpSubscription forwards messages from a subscription into a channel so that they can be drained without blocking
+func pumpSubscription(ctx context.Context, sub *pubsub.Subscription, out chan<- *pubsub.Message) {
+	defer close(out)
 	for {
 		m, err := sub.Next(ctx)
 		if m == nil { // This happens when the context gets canceled!
@@ -513,30 +3121,206 @@ func reciever(nid int, ctx context.Context, sub *pubsub.Subscription) {
 		if err != nil {
 			panic(err)
 		}
+		out <- m
+	}
+}
+
+// drainBatch appends any messages which are already waiting (or arrive within the latency bound) to the batch
+// Returns false if the channel has been closed
+func drainBatch(batch []*pubsub.Message, messages <-chan *pubsub.Message, limits batchLimits) ([]*pubsub.Message, bool) {
+	var timeout *time.Timer
+	defer func() {
+		if timeout != nil {
+			timeout.Stop()
+		}
+	}()
+
+	for len(batch) < limits.count {
+		select {
+		case m, ok := <-messages:
+			if !ok {
+				return batch, false
+			}
+			batch = append(batch, m)
+			continue
+		default:
+		}
+
+		// Nothing is buffered, wait for the rest of the latency bound (if any) for something to arrive
+		if limits.latency <= 0 {
+			return batch, true
+		}
+		if timeout == nil {
+			timeout = time.NewTimer(limits.latency)
+		}
+		select {
+		case m, ok := <-messages:
+			if !ok {
+				return batch, false
+			}
+			batch = append(batch, m)
+		case <-timeout.C:
+			return batch, true
+		}
+	}
+	return batch, true
+}
+
+// queueRetryInterval is how long a reciever waits before retrying to push into a full message queue whose overflow policy is to block
+const queueRetryInterval = 50 * time.Microsecond
+
+// queueBatch pushes a batch of messages into a C message queue, waiting for space to become available if the queue blocks when full
+func queueBatch(ctx context.Context, state unsafe.Pointer, batch []C.Message) {
+	for len(batch) > 0 {
+		queued := int(C.bridge_queue_messages(state, &batch[0], C.int(len(batch))))
+		batch = batch[queued:]
+		if len(batch) > 0 {
+			if ctx.Err() != nil {
+				return // Shutting down, nobody will drain the queue anymore
+			}
+			time.Sleep(queueRetryInterval)
+		}
+	}
+}
+
+// reciever receives messages from a subscription and hands them to C in batches
+func reciever(s *State, sub *pubsub.Subscription, messages chan *pubsub.Message, stats *trafficStats) {
+	go pumpSubscription(s.ctx, sub, messages)
+
+	localID := s.host.ID()
+	var buffer messageBuffer
+	defer buffer.release()
+	batch := make([]*pubsub.Message, 0, defaultBatchLimits.count)
+	cbatch := make([]C.Message, 0, defaultBatchLimits.count)
+
+	for open := true; open; {
+		m, ok := <-messages
+		if !ok {
+			return
+		}
+
+		batch, open = drainBatch(append(batch[:0], m), messages, s.getBatchLimits())
+
+		// NOTE: The buffer gets reused for the next batch so C must copy anything it wants to keep!
+		size, dataSize := 0, 0
+		for _, m := range batch {
+			size += packedMessageSize(m)
+		}
+		buffer.reserve(size)
+		if cap(cbatch) < len(batch) {
+			cbatch = make([]C.Message, len(batch))
+		}
+		cbatch = cbatch[:len(batch)]
+		tracking, now := s.latencyTracking.Load(), time.Now()
+		for i, m := range batch {
+			// NOTE: The message itself is never modified since pubsub may still be forwarding it
+			// Only networks tracking latency expect the header, anything else could legitimately start with the same magic bytes
+			data := m.Data
+			if tracking {
+				var published int64
+				if data, published = splitLatency(m.Data); published != 0 && m.ReceivedFrom != localID {
+					stats.recordLatency(time.Duration(now.UnixNano() - published))
+				}
+			}
+			dataSize += len(data)
+			packMessage(s.id, localID, s.handles, &buffer, m, data, &cbatch[i])
+		}
 
-		cnid := C.int(nid)
-		cfrom := C.CString(string(m.Message.From))
-		defer C.free(unsafe.Pointer(cfrom))
-		cdata := C.CString(string(m.Message.Data))
-		defer C.free(unsafe.Pointer(cdata))
-		cseqno := C.CString(string(m.Message.Seqno))
-		defer C.free(unsafe.Pointer(cseqno))
-		ctopic := C.CString(*m.Message.Topic)
-		defer C.free(unsafe.Pointer(ctopic))
-		csignature := C.CString(string(m.Message.Signature))
-		defer C.free(unsafe.Pointer(csignature))
-		ckey := C.CString(string(m.Message.Key))
-		defer C.free(unsafe.Pointer(ckey))
-		cID := C.CString(string(m.ID))
-		defer C.free(unsafe.Pointer(cID))
-		creceivedFrom := C.CString(string(m.ReceivedFrom))
-		defer C.free(unsafe.Pointer(creceivedFrom))
-
-		msg := C.Message{network: cnid, from: cfrom, data: cdata, seqno: cseqno, topic: ctopic, signature: csignature, key: ckey, id: cID, recieved_from: creceivedFrom}
-		if !C.bridge_msg_callback(cnid, &msg, messageCallbacks[nid]) {
-			panic("Failed to pass message to C!")
+		stats.received(len(batch), dataSize)
+		s.stats.received(len(batch), dataSize)
+		if poll := s.getPoll(); poll.messages {
+			queueBatch(s.ctx, poll.state, cbatch)
+		} else {
+			callbacks, start := s.getCallbacks(), time.Now()
+			success := C.bridge_msg_batch_callback(C.int(s.id), &cbatch[0], C.int(len(cbatch)), callbacks.messageBatch.f, callbacks.messageBatch.userData, callbacks.message.f, callbacks.message.userData)
+			if callbacks.messageBatch.f != nil || callbacks.message.f != nil {
+				s.stats.timeCallback(C.CALLBACK_MESSAGE, start)
+			}
+			if !success {
+				panic("Failed to pass message to C!")
+			}
 		}
+		for i := range batch {
+			batch[i] = nil // Don't keep the delivered messages alive until the next batch
+		}
+	}
+}
+
+// cpuProfile is the file the running CPU profile (if any) is being written to
+var cpuProfile struct {
+	sync.Mutex
+	file *os.File
+}
+
+// startCPUProfile starts writing a pprof CPU profile of the Go half of the process to path (until stopCPUProfile is called)
+//
+//export startCPUProfile
+func startCPUProfile(path string) bool {
+	cpuProfile.Lock()
+	defer cpuProfile.Unlock()
+	if cpuProfile.file != nil {
+		logf(nil, C.LOG_ERROR, "A CPU profile is already running")
+		return false
+	}
+
+	f, err := os.Create(path)
+	if err != nil {
+		logf(nil, C.LOG_ERROR, "Failed to create CPU profile: %v", err)
+		return false
+	}
+	if err := pprof.StartCPUProfile(f); err != nil {
+		logf(nil, C.LOG_ERROR, "Failed to start CPU profile: %v", err)
+		f.Close()
+		return false
+	}
+	cpuProfile.file = f
+	return true
+}
+
+// stopCPUProfile stops the running CPU profile and finishes writing it
+//
+//export stopCPUProfile
+func stopCPUProfile() bool {
+	cpuProfile.Lock()
+	defer cpuProfile.Unlock()
+	if cpuProfile.file == nil {
+		return false
+	}
+
+	pprof.StopCPUProfile()
+	err := cpuProfile.file.Close()
+	cpuProfile.file = nil
+	return err == nil
+}
+
+// writeProfile writes one of the runtime's named pprof profiles to path
+func writeProfile(name string, path string) bool {
+	f, err := os.Create(path)
+	if err != nil {
+		logf(nil, C.LOG_ERROR, "Failed to create %s profile: %v", name, err)
+		return false
 	}
+	if err := pprof.Lookup(name).WriteTo(f, 0); err != nil {
+		logf(nil, C.LOG_ERROR, "Failed to write %s profile: %v", name, err)
+		f.Close()
+		return false
+	}
+	return f.Close() == nil
+}
+
+// writeHeapProfile writes a pprof heap profile of the Go half of the process to path
+//
+//export writeHeapProfile
+func writeHeapProfile(path string) bool {
+	runtime.GC() // Make sure the profile is up to date with every allocation made so far
+	return writeProfile("heap", path)
+}
+
+// writeGoroutineDump writes a pprof profile of every running goroutine's stack to path
+//
+//export writeGoroutineDump
+func writeGoroutineDump(path string) bool {
+	return writeProfile("goroutine", path)
 }
 
 // Dummy needed for CGO to properly work!
@@ -0,0 +1,338 @@
+package main
+
+// Run from the directory containing go.mod (generated by CMake) with:
+// go test -race -tags simplep2p_test src/libp2p.go src/libp2p_testing.go src/libp2p_test.go
+
+import (
+	"fmt"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+	"unsafe"
+
+	pubsub "github.com/libp2p/go-libp2p-pubsub"
+	pb "github.com/libp2p/go-libp2p-pubsub/pb"
+	"github.com/libp2p/go-libp2p/core/peer"
+)
+
+// startSimulated initializes count networks inside a new simulation, so no sockets or internet access are needed
+func startSimulated(t *testing.T, count int) []int {
+	sid := createSimulation(0, 0, 0, 1)
+	t.Cleanup(func() { destroySimulation(sid) })
+
+	var nets []int
+	for i := 0; i < count; i++ {
+		nid := initialize("", "simplep2p/test", "", 5, false, false, nil, 0, true, 1, 2, sid, nil, nil, nil)
+		if nid < 0 {
+			t.Fatal("Failed to initialize network", i)
+		}
+		nets = append(nets, nid)
+	}
+	return nets
+}
+
+// TestConcurrentTopics subscribes to, publishes in, and leaves topics from many goroutines on several networks at once, while one of them shuts down
+func TestConcurrentTopics(t *testing.T) {
+	nets := startSimulated(t, 3)
+
+	var wg sync.WaitGroup
+	for _, nid := range nets {
+		for w := 0; w < 8; w++ {
+			wg.Add(1)
+			go func(nid, w int) {
+				defer wg.Done()
+				for i := 0; i < 200; i++ {
+					name := fmt.Sprint("topic", w, "-", i%5)
+					id := subscribeToTopic(nid, name)
+					broadcastMessage(nid, "hello", id)
+					broadcastMessage(nid, "hello", 0)
+					broadcastMessageAsync(nid, nil, 0, 0, nil, nil)
+					findTopic(nid, name)
+					setMessageBatchLimits(nid, 8, 0)
+					if id >= 0 {
+						leaveTopic(nid, id)
+					}
+					networkValid(nid)
+					networksCount()
+				}
+			}(nid, w)
+		}
+	}
+	wg.Add(1)
+	go func() {
+		defer wg.Done()
+		shutdown(nets[2])
+	}()
+	wg.Wait()
+
+	for _, nid := range nets[:2] {
+		shutdown(nid)
+	}
+	for _, nid := range nets {
+		if networkValid(nid) {
+			t.Error("Network", nid, "is still valid after shutdown")
+		}
+	}
+}
+
+// TestConfigureAhead checks that only the next network can be configured before it is initialized
+func TestConfigureAhead(t *testing.T) {
+	next := nextNetwork()
+	setMessageBatchLimits(next+1000, 8, 0)
+	states.RLock()
+	_, leaked := states.states[next+1000]
+	states.RUnlock()
+	if leaked {
+		t.Error("Configuring a network far ahead of the next one allocated its state")
+	}
+
+	setMessageBatchLimits(next, 8, 0)
+	nid := startSimulated(t, 1)[0]
+	defer shutdown(nid)
+	if nid != next || states.get(nid).getBatchLimits().count != 8 {
+		t.Error("Configuration applied ahead of time was lost")
+	}
+}
+
+// TestSimulatedLoss checks that loss is applied to each message crossing a link (before pubsub marks it as seen)
+func TestSimulatedLoss(t *testing.T) {
+	sid := createSimulation(0, 0, 0.5, 1)
+	defer destroySimulation(sid)
+	nets := make([]int, 2)
+	for i := range nets {
+		nets[i] = initialize("", "simplep2p/test", "", 5, false, false, nil, 0, true, 1, 1, sid, nil, nil, nil)
+		defer shutdown(nets[i])
+	}
+
+	a, b := states.get(nets[0]), states.get(nets[1])
+	rpc := &pubsub.RPC{RPC: pb.RPC{Publish: make([]*pb.Message, 1000)}}
+	a.simulation.inspector(a.host.ID())(b.host.ID(), rpc)
+	if kept := len(rpc.Publish); kept < 400 || kept > 600 {
+		t.Errorf("%d of 1000 messages survived a link with 50%% loss", kept)
+	}
+
+	if !setLinkOptions(sid, nets[0], nets[1], 0, 0, 0) {
+		t.Fatal("Failed to change the link's options")
+	}
+	rpc.Publish = make([]*pb.Message, 1000)
+	a.simulation.inspector(a.host.ID())(b.host.ID(), rpc)
+	if len(rpc.Publish) != 1000 {
+		t.Errorf("Messages were lost crossing a link without loss")
+	}
+}
+
+// TestPollStateInstall races to give a network its poll state, which must only be accepted once and never after shutdown
+func TestPollStateInstall(t *testing.T) {
+	nid := startSimulated(t, 1)[0]
+
+	candidates := make([]int, 8)
+	installed := make([]unsafe.Pointer, len(candidates))
+	var wg sync.WaitGroup
+	for i := range candidates {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			installed[i] = installPollState(nid, unsafe.Pointer(&candidates[i]))
+		}(i)
+	}
+	wg.Wait()
+	for _, state := range installed {
+		if state == nil || state != installed[0] {
+			t.Fatal("Concurrent installs didn't agree on a single poll state")
+		}
+	}
+	if !enablePollQueue(nid, true) {
+		t.Error("Failed to enable the event queue of a running network")
+	}
+
+	if shutdown(nid) != installed[0] {
+		t.Error("Shutdown didn't hand back the installed poll state")
+	}
+	if installPollState(nid, unsafe.Pointer(&candidates[0])) != nil || enablePollQueue(nid, false) {
+		t.Error("A network which was shutdown accepted a poll state")
+	}
+}
+
+// TestResubscribe leaves and immediately rejoins the same topic, which must never find pubsub still holding on to it
+func TestResubscribe(t *testing.T) {
+	nid := startSimulated(t, 1)[0]
+	defer shutdown(nid)
+
+	for i := 0; i < 100; i++ {
+		id := subscribeToTopic(nid, "resubscribe")
+		if id < 0 {
+			t.Fatal("Failed to rejoin a topic after leaving it, attempt", i)
+		}
+		if !leaveTopic(nid, id) {
+			t.Fatal("Failed to leave a topic, attempt", i)
+		}
+	}
+}
+
+// TestPeerHandleLookup checks that looking up a handle never assigns one, so C can't grow the table with arbitrary IDs
+func TestPeerHandleLookup(t *testing.T) {
+	nid := startSimulated(t, 1)[0]
+	defer shutdown(nid)
+
+	s := states.get(nid)
+	if peerHandle(nid, string(s.host.ID())) != 0 {
+		t.Error("The network's own ID isn't handle 0")
+	}
+	for i := 0; i < 100; i++ {
+		if peerHandle(nid, fmt.Sprint("unknown", i)) != -1 {
+			t.Fatal("An unseen peer was given a handle")
+		}
+	}
+	s.handles.RLock()
+	count := len(s.handles.ids)
+	s.handles.RUnlock()
+	if count != 1 {
+		t.Error("Looking up unseen peers grew the handle table")
+	}
+}
+
+// TestUnsetCallbacksNotProfiled checks that notifications with no callback to invoke aren't counted as calls into the application
+func TestUnsetCallbacksNotProfiled(t *testing.T) {
+	nid := startSimulated(t, 1)[0]
+	defer shutdown(nid)
+
+	s := states.get(nid)
+	before := s.stats.callbacks.Load()
+	notifyTopic(s, 2, 0, s.getCallbacks().topicSubscribed) // 2 is EVENT_TOPIC_SUBSCRIBED
+	notifyNetwork(s, 4, s.getCallbacks().connected)        // 4 is EVENT_CONNECTED
+	if after := s.stats.callbacks.Load(); after != before {
+		t.Error(after-before, "calls were profiled without a callback set")
+	}
+}
+
+// TestShutdownJoinsBackground checks that shutdown waits for the network's background goroutines (which could otherwise touch freed C memory) and refuses to start more
+func TestShutdownJoinsBackground(t *testing.T) {
+	nid := startSimulated(t, 1)[0]
+	s := states.get(nid)
+
+	var finished atomic.Bool
+	s.spawn(func() {
+		<-s.ctx.Done()
+		time.Sleep(50 * time.Millisecond) // Like a notification still in flight when shutdown begins
+		finished.Store(true)
+	})
+	shutdown(nid)
+	if !finished.Load() {
+		t.Error("Shutdown returned before a background goroutine finished")
+	}
+	if s.spawn(func() {}) {
+		t.Error("A background goroutine was started after shutdown")
+	}
+}
+
+// TestShutdownClearsCallbacks checks that no callback (or its userData) is kept once shutdown returns, since the application may free it straight away
+func TestShutdownClearsCallbacks(t *testing.T) {
+	nid := startSimulated(t, 1)[0]
+	s := states.get(nid)
+
+	var owner byte
+	s.Lock()
+	s.callbacks.error.userData = unsafe.Pointer(&owner)
+	s.Unlock()
+	shutdown(nid)
+	if s.getCallbacks() != (callbacks{}) {
+		t.Error("Callbacks survived shutdown")
+	}
+}
+
+// TestAsyncPublishReconfigure races queuing the first message against replacing the publisher, the message must never be stranded in the replaced one
+func TestAsyncPublishReconfigure(t *testing.T) {
+	nid := startSimulated(t, 1)[0]
+	defer shutdown(nid)
+	s := states.get(nid)
+	topic := subscribeToTopic(nid, "async")
+
+	for i := 0; i < 200; i++ {
+		old := newAsyncPublisher(16, 1, 0, 0)
+		s.Lock()
+		s.publisher = old
+		s.Unlock()
+
+		var wg sync.WaitGroup
+		var replaced bool
+		wg.Add(2)
+		go func() {
+			defer wg.Done()
+			broadcastMessageAsync(nid, nil, 0, topic, nil, nil)
+		}()
+		go func() {
+			defer wg.Done()
+			replaced = configureAsyncPublish(nid, 16, 1, 0, 0)
+		}()
+		wg.Wait()
+		if replaced && len(old.jobs) != 0 {
+			t.Fatal("A message was queued into a publisher which had been replaced (and will never run)")
+		}
+	}
+}
+
+// TestConcurrentInitialize initializes and shuts down networks from many goroutines at once, every network must get its own ID
+func TestConcurrentInitialize(t *testing.T) {
+	sid := createSimulation(0, 0, 0, 1)
+	defer destroySimulation(sid)
+
+	ids := make([]int, 16)
+	var wg sync.WaitGroup
+	for i := range ids {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			ids[i] = initialize("", "simplep2p/test", "", 5, false, false, nil, 0, true, 1, 1, sid, nil, nil, nil)
+			nextNetwork()
+			networksCount()
+		}(i)
+	}
+	wg.Wait()
+
+	seen := make(map[int]bool)
+	for _, nid := range ids {
+		if nid < 0 || seen[nid] || !networkValid(nid) {
+			t.Fatal("Concurrent initialization produced an invalid or duplicate ID", nid)
+		}
+		seen[nid] = true
+	}
+	for _, nid := range ids {
+		wg.Add(1)
+		go func(nid int) {
+			defer wg.Done()
+			shutdown(nid)
+		}(nid)
+	}
+	wg.Wait()
+	for _, nid := range ids {
+		if networkValid(nid) {
+			t.Error("Network", nid, "is still valid after shutdown")
+		}
+	}
+}
+
+// TestDuplicateDialsShareResult checks that dialing a peer which is already being dialed waits for that dial and reports its result
+func TestDuplicateDialsShareResult(t *testing.T) {
+	nid := startSimulated(t, 1)[0]
+	defer shutdown(nid)
+	s := states.get(nid)
+
+	const p = peer.ID("in-flight")
+	dial, owner := s.dialer.acquire(s, s.ctx, p)
+	if dial == nil || !owner {
+		t.Fatal("Failed to start a dial")
+	}
+	result := make(chan bool)
+	go func() { result <- connectToPeer(s, s.ctx, peer.AddrInfo{ID: p}, s.discovery) }()
+
+	select {
+	case <-result:
+		t.Fatal("A duplicate dial returned before the dial in flight finished")
+	case <-time.After(50 * time.Millisecond):
+	}
+	s.dialer.release(p, true)
+	if !<-result {
+		t.Error("A duplicate dial didn't report the success of the dial in flight")
+	}
+}
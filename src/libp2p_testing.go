@@ -0,0 +1,21 @@
+//go:build simplep2p_test
+
+package main
+
+// Stand-ins for the C bridges (normally provided by simplep2p.c) so that the Go half of the library can be tested on its own
+// The callbacks are never invoked, every bridge reports success
+
+/*
+#include <stdbool.h>
+
+bool bridge_msg_batch_callback(int n, void* m, int count, void* batch, void* batchUserData, void* f, void* userData) { return true; }
+int bridge_queue_messages(void* state, void* m, int count) { return count; }
+bool bridge_publish_callback(int n, bool success, void* f, void* userData) { return true; }
+bool bridge_queue_event(void* state, int n, int type, int topic, int peer, int error, _GoString_ detail) { return true; }
+bool bridge_void_callback(int n, void* f, void* userData) { return true; }
+bool bridge_peer_callback(int n, char* p, int h, void* f, void* userData) { return true; }
+bool bridge_topic_callback(int n, int t, void* f, void* userData) { return true; }
+bool bridge_error_callback(int n, int e, char* m, void* f, void* userData) { return true; }
+void bridge_log_callback(void* records, int count, void* f, void* userData) {}
+*/
+import "C"
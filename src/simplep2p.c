@@ -1,3 +1,6 @@
+#ifndef _WIN32
+	#define _POSIX_C_SOURCE 199309L // For clock_gettime when compiling in strict ISO C mode
+#endif
 #include "libsimplep2p_golib.h"
 #include "simplep2p.h"
 
@@ -6,6 +9,44 @@ extern "C" {
 #endif
 
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+#ifdef __linux__
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#endif
+#ifdef _WIN32
+	#include <malloc.h>
+#endif
+#include <time.h>
+
+/**
+ * @brief Nanoseconds spent inside the application's callbacks, indexed by P2PCallbackKind.
+ */
+static atomic_ullong p2p_callback_nanoseconds[P2P_CALLBACK_KIND_COUNT];
+
+/**
+ * @brief Reads a clock (monotonic where available) in nanoseconds, for timing callbacks.
+ */
+static uint64_t p2p_now_nanoseconds() {
+	struct timespec now;
+#ifdef _WIN32
+	timespec_get(&now, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Records the time spent inside an application callback which started at start.
+ */
+static void p2p_time_callback(P2PCallbackKind kind, uint64_t start) {
+	atomic_fetch_add_explicit(&p2p_callback_nanoseconds[kind], p2p_now_nanoseconds() - start, memory_order_relaxed);
+}
 
 /**
  * @brief Bridges a void callback function from C to Go.
@@ -13,25 +54,55 @@ extern "C" {
  * This function bridges a void callback function from C to Go. It checks if the function is NULL and then invokes it.
  *
  * @param f The void callback function to bridge.
+ * @param userData The pointer provided alongside the callback function.
  * @return True if everything went well, False if Go should panic
  */
-bool bridge_void_callback(P2PNetwork n, void_callback f) {
+bool bridge_void_callback(P2PNetwork n, void_callback f, void* userData) {
 	if(f == NULL) return true;
-	return f(n);
+	uint64_t start = p2p_now_nanoseconds();
+	bool out = f(n, userData);
+	p2p_time_callback(P2P_CALLBACK_NETWORK, start);
+	return out;
 }
 
 /**
- * @brief Bridges a message callback function from C to Go.
+ * @brief Bridges the message callback functions from C to Go.
  *
- * This function bridges a message callback function from C to Go. It checks if the function is NULL and then invokes it with the provided message.
+ * This function bridges a batch of messages from C to Go. It passes the whole batch to the batch callback (if it is not NULL) and then invokes the message callback (if it is not NULL) for each message, so that only one transition is needed per batch.
  *
- * @param m The message to pass to the callback function.
+ * @param m The messages to pass to the callback functions.
+ * @param count The number of messages in m.
+ * @param batch The message batch callback function to bridge.
+ * @param batchUserData The pointer provided alongside the message batch callback function.
  * @param f The message callback function to bridge.
+ * @param userData The pointer provided alongside the message callback function.
  * @return True if everything went well, False if Go should panic
  */
-bool bridge_msg_callback(P2PNetwork n, Message* m, msg_callback f) {
+bool bridge_msg_batch_callback(P2PNetwork n, Message* m, int count, msg_batch_callback batch, void* batchUserData, msg_callback f, void* userData) {
+	uint64_t start = p2p_now_nanoseconds();
+	bool out = batch == NULL || batch(n, m, count, batchUserData);
+	for(int i = 0; out && f != NULL && i < count; i++)
+		out = f(n, m + i, userData);
+	p2p_time_callback(P2P_CALLBACK_MESSAGE, start);
+	return out;
+}
+
+/**
+ * @brief Bridges a publish completion callback function from C to Go.
+ *
+ * This function bridges a publish completion callback function from C to Go. It checks if the function is NULL and then invokes it with the result of the publish.
+ *
+ * @param success Whether or not the message was successfully published.
+ * @param f The publish callback function to bridge.
+ * @param userData The pointer provided alongside the message.
+ * @return True if everything went well, False if Go should panic
+ */
+bool bridge_publish_callback(P2PNetwork n, bool success, publish_callback f, void* userData) {
 	if(f == NULL) return true;
-	return f(n, m);
+	uint64_t start = p2p_now_nanoseconds();
+	bool out = f(n, success, userData);
+	p2p_time_callback(P2P_CALLBACK_PUBLISH, start);
+	return out;
 }
 
 /**
@@ -40,12 +111,17 @@ bool bridge_msg_callback(P2PNetwork n, Message* m, msg_callback f) {
  * This function bridges a peer callback function from C to Go. It checks if the function is NULL and then invokes it with the provided peer.
  *
  * @param p The peer to pass to the callback function.
+ * @param h The handle of the peer.
  * @param f The peer callback function to bridge.
+ * @param userData The pointer provided alongside the callback function.
  * @return True if everything went well, False if Go should panic
  */
-bool bridge_peer_callback(P2PNetwork n, char* p, peer_callback f) {
+bool bridge_peer_callback(P2PNetwork n, char* p, int h, peer_callback f, void* userData) {
 	if(f == NULL) return true;
-	return f(n, p);
+	uint64_t start = p2p_now_nanoseconds();
+	bool out = f(n, p, h, userData);
+	p2p_time_callback(P2P_CALLBACK_PEER, start);
+	return out;
 }
 
 /**
@@ -55,11 +131,475 @@ bool bridge_peer_callback(P2PNetwork n, char* p, peer_callback f) {
  *
  * @param t The topic to pass to the callback function.
  * @param f The topic callback function to bridge.
+ * @param userData The pointer provided alongside the callback function.
  * @return True if everything went well, False if Go should panic
  */
-bool bridge_topic_callback(P2PNetwork n, int t, topic_callback f){
+bool bridge_topic_callback(P2PNetwork n, int t, topic_callback f, void* userData){
 	if(f == NULL) return true;
-	return f(n, t);
+	uint64_t start = p2p_now_nanoseconds();
+	bool out = f(n, t, userData);
+	p2p_time_callback(P2P_CALLBACK_TOPIC, start);
+	return out;
+}
+
+/**
+ * @brief Bridges an error callback function from C to Go.
+ *
+ * This function bridges an error callback function from C to Go. It checks if the function is NULL and then invokes it with the provided error.
+ *
+ * @param e The error to pass to the callback function.
+ * @param m The description of the error to pass to the callback function.
+ * @param f The error callback function to bridge.
+ * @param userData The pointer provided alongside the callback function.
+ * @return True if everything went well, False if Go should panic
+ */
+bool bridge_error_callback(P2PNetwork n, int e, char* m, error_callback f, void* userData){
+	if(f == NULL) return true;
+	uint64_t start = p2p_now_nanoseconds();
+	bool out = f(n, (P2PError)e, m, userData);
+	p2p_time_callback(P2P_CALLBACK_ERROR, start);
+	return out;
+}
+
+/**
+ * @brief Bridges a log callback function from C to Go.
+ *
+ * This function bridges a log callback function from C to Go. It checks if the function is NULL and then invokes it with the provided records.
+ *
+ * @param records The batch of log records to pass to the callback function.
+ * @param count The number of records in the batch.
+ * @param f The log callback function to bridge.
+ * @param userData The pointer provided alongside the callback function.
+ */
+void bridge_log_callback(LogRecord* records, int count, log_callback f, void* userData) {
+	if(f == NULL) return;
+	f(records, count, userData);
+}
+
+
+
+
+// Message and Event Queues
+
+
+
+/**
+ * @brief A single slot in a message queue.
+ *
+ * The sequence number tells producers and the consumer whose turn it is to use the slot.
+ */
+typedef struct {
+	atomic_size_t sequence;
+	void* item;
+} P2PQueueCell;
+
+/**
+ * @brief Bounded lock-free queue that recievers push messages into and the application polls them out of.
+ *
+ * Based on Dmitry Vyukov's bounded MPMC queue; many Go threads may push at once while a single application thread polls.
+ */
+typedef struct {
+	P2PQueueCell* cells;
+	size_t mask;                           ///< capacity - 1 (capacity is always a power of two)
+	P2POverflowPolicy policy;
+	alignas(64) atomic_size_t enqueuePos;  ///< Kept on separate cache lines so producers and the consumer don't contend
+	alignas(64) atomic_size_t dequeuePos;
+	alignas(64) atomic_ullong dropped;
+	void** held;                           ///< Items returned by the last poll, freed by the next poll
+	int heldCount;
+	int heldCapacity;
+} P2PQueue;
+
+/**
+ * @brief A message copied into a single allocation so it can outlive the reciever's buffer.
+ */
+typedef struct {
+	P2PMessage message;
+	char data[];
+} P2PQueuedMessage;
+
+/**
+ * @brief Allocates zeroed memory aligned to a cache line, so alignas(64) members really do get lines of their own.
+ * @note Must be freed with p2p_aligned_free().
+ */
+static void* p2p_aligned_calloc(size_t size) {
+	size = (size + 63) & ~(size_t)63; // aligned_alloc requires the size to be a multiple of the alignment
+#ifdef _WIN32
+	void* out = _aligned_malloc(size, 64);
+#else
+	void* out = aligned_alloc(64, size);
+#endif
+	if(out != NULL) memset(out, 0, size);
+	return out;
+}
+
+/**
+ * @brief Frees memory allocated by p2p_aligned_calloc().
+ */
+static void p2p_aligned_free(void* memory) {
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+/**
+ * @brief Creates a queue able to hold at least capacity items.
+ * @return The queue, or NULL if it couldn't be allocated.
+ */
+static P2PQueue* p2p_queue_create(int capacity, P2POverflowPolicy policy) {
+	size_t size = 2;
+	while(size < (size_t)capacity) size <<= 1;
+
+	P2PQueue* q = (P2PQueue*)p2p_aligned_calloc(sizeof(P2PQueue));
+	if(q == NULL) return NULL;
+	q->cells = (P2PQueueCell*)malloc(size * sizeof(P2PQueueCell));
+	if(q->cells == NULL) {
+		p2p_aligned_free(q);
+		return NULL;
+	}
+	for(size_t i = 0; i < size; i++)
+		atomic_init(&q->cells[i].sequence, i);
+	q->mask = size - 1;
+	q->policy = policy;
+	return q;
+}
+
+/**
+ * @brief Attempts to add an item to the back of the queue.
+ * @return False if the queue is full.
+ */
+static bool p2p_queue_try_push(P2PQueue* q, void* item) {
+	size_t pos = atomic_load_explicit(&q->enqueuePos, memory_order_relaxed);
+	for(;;) {
+		P2PQueueCell* cell = &q->cells[pos & q->mask];
+		size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if(dif == 0) {
+			if(atomic_compare_exchange_weak_explicit(&q->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				cell->item = item;
+				atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+				return true;
+			}
+		} else if(dif < 0)
+			return false;
+		else pos = atomic_load_explicit(&q->enqueuePos, memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief Attempts to remove an item from the front of the queue.
+ * @return The item or NULL if the queue is empty.
+ */
+static void* p2p_queue_try_pop(P2PQueue* q) {
+	size_t pos = atomic_load_explicit(&q->dequeuePos, memory_order_relaxed);
+	for(;;) {
+		P2PQueueCell* cell = &q->cells[pos & q->mask];
+		size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if(dif == 0) {
+			if(atomic_compare_exchange_weak_explicit(&q->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				void* item = cell->item;
+				atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+				return item;
+			}
+		} else if(dif < 0)
+			return NULL;
+		else pos = atomic_load_explicit(&q->dequeuePos, memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief Adds an item to the queue, applying the queue's overflow policy if it is full.
+ * @return False if the queue is full and its policy is to block (the caller keeps ownership of the item).
+ */
+static bool p2p_queue_push(P2PQueue* q, void* item) {
+	while(!p2p_queue_try_push(q, item))
+		switch(q->policy) {
+		case P2P_OVERFLOW_DROP_NEWEST:
+			free(item);
+			atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+			return true;
+		case P2P_OVERFLOW_DROP_OLDEST: {
+			void* oldest = p2p_queue_try_pop(q);
+			if(oldest != NULL) {
+				free(oldest);
+				atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+			}
+		} break;
+		default:
+			return false;
+		}
+	return true;
+}
+
+/**
+ * @brief Frees the items handed out by the previous poll and makes room for max more.
+ * @return False if there wasn't enough memory to make room.
+ */
+static bool p2p_queue_release_held(P2PQueue* q, int max) {
+	for(int i = 0; i < q->heldCount; i++)
+		free(q->held[i]);
+	q->heldCount = 0;
+
+	if(max > q->heldCapacity) {
+		free(q->held);
+		q->held = (void**)malloc(max * sizeof(void*));
+		q->heldCapacity = q->held != NULL ? max : 0;
+		if(q->held == NULL) return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Frees a queue along with every item still inside of it.
+ */
+static void p2p_queue_free(P2PQueue* q) {
+	if(q == NULL) return;
+	p2p_queue_release_held(q, 0);
+	for(void* item; (item = p2p_queue_try_pop(q)) != NULL; )
+		free(item);
+	free(q->held);
+	free(q->cells);
+	p2p_aligned_free(q);
+}
+
+/**
+ * @brief An event copied into a single allocation (along with its peer ID).
+ */
+typedef struct {
+	P2PEvent event;
+	char peer[];
+} P2PQueuedEvent;
+
+/**
+ * @brief The queues of a network whose messages and/or events are polled instead of being passed to callbacks.
+ */
+typedef struct {
+	_Atomic(P2PQueue*) messages; ///< Only ever set once (NULL until the queue is enabled)
+	_Atomic(P2PQueue*) events;
+	atomic_int eventFD;     ///< Descriptor signaled when either queue gets something pushed into it (-1 if none has been requested)
+	atomic_bool signaled;   ///< Set once the descriptor has been signaled, so producers only make a syscall when the consumer may be waiting
+} P2PPollState;
+
+#define P2P_POLL_CHUNK_SIZE 256
+#define P2P_POLL_CHUNK_COUNT 4096
+
+/**
+ * @brief Caches every network's poll state (indexed by network ID) so polling never has to cross into Go, or take its locks, to find it.
+ *
+ * Chunks are allocated as networks get poll states and live until the process exits, networks past the end of the table ask Go instead.
+ */
+static _Atomic(_Atomic(P2PPollState*)*) p2p_poll_chunks[P2P_POLL_CHUNK_COUNT];
+
+/**
+ * @brief Finds a network's slot in the poll state cache, optionally allocating its chunk.
+ * @return The slot, or NULL if the network is outside the cache (or its chunk doesn't exist and couldn't be created).
+ */
+static _Atomic(P2PPollState*)* p2p_poll_slot(P2PNetwork network, bool create) {
+	if(network < 0 || network >= P2P_POLL_CHUNK_SIZE * P2P_POLL_CHUNK_COUNT) return NULL;
+	_Atomic(_Atomic(P2PPollState*)*)* chunkSlot = &p2p_poll_chunks[network / P2P_POLL_CHUNK_SIZE];
+	_Atomic(P2PPollState*)* chunk = atomic_load_explicit(chunkSlot, memory_order_acquire);
+	if(chunk == NULL && create) {
+		_Atomic(P2PPollState*)* fresh = (_Atomic(P2PPollState*)*)malloc(P2P_POLL_CHUNK_SIZE * sizeof(_Atomic(P2PPollState*)));
+		if(fresh == NULL) return NULL;
+		for(int i = 0; i < P2P_POLL_CHUNK_SIZE; i++)
+			atomic_init(&fresh[i], NULL);
+		if(atomic_compare_exchange_strong_explicit(chunkSlot, &chunk, fresh, memory_order_acq_rel, memory_order_acquire))
+			chunk = fresh;
+		else free(fresh); // Another thread created the chunk first
+	}
+	return chunk != NULL ? &chunk[network % P2P_POLL_CHUNK_SIZE] : NULL;
+}
+
+/**
+ * @brief Finds the poll state of a network without creating it.
+ * @return The poll state, or NULL if the network doesn't have one.
+ */
+static P2PPollState* p2p_find_poll_state(P2PNetwork network) {
+	_Atomic(P2PPollState*)* slot = p2p_poll_slot(network, false);
+	if(slot != NULL) return atomic_load_explicit(slot, memory_order_acquire);
+	return (P2PPollState*)getPollState(network); // Outside the cache (or nothing in its chunk has a poll state), so ask Go
+}
+
+/**
+ * @brief Finds the poll state of a network, creating it if it doesn't exist yet.
+ * @return The poll state, or NULL if the network has been shutdown (or it couldn't be allocated).
+ */
+static P2PPollState* p2p_poll_state(P2PNetwork network) {
+	P2PPollState* state = p2p_find_poll_state(network);
+	if(state != NULL) return state;
+
+	state = (P2PPollState*)calloc(1, sizeof(P2PPollState));
+	if(state == NULL) return NULL;
+	atomic_init(&state->messages, NULL);
+	atomic_init(&state->events, NULL);
+	atomic_init(&state->eventFD, -1);
+	atomic_init(&state->signaled, false);
+
+	// Go only keeps the first state installed, if another thread beat us (or the network is gone) ours is thrown away
+	P2PPollState* installed = (P2PPollState*)installPollState(network, state);
+	if(installed != state) free(state);
+
+	_Atomic(P2PPollState*)* slot;
+	if(installed != NULL && (slot = p2p_poll_slot(network, true)) != NULL)
+		atomic_store_explicit(slot, installed, memory_order_release);
+	return installed;
+}
+
+/**
+ * @brief Gives a poll state a queue, unless it already has one.
+ * @return False if the slot was already filled (or the queue couldn't be allocated).
+ */
+static bool p2p_poll_state_claim(_Atomic(P2PQueue*)* slot, int capacity, P2POverflowPolicy policy) {
+	if(atomic_load_explicit(slot, memory_order_acquire) != NULL) return false;
+	P2PQueue* q = p2p_queue_create(capacity, policy);
+	if(q == NULL) return false;
+
+	P2PQueue* expected = NULL;
+	if(!atomic_compare_exchange_strong_explicit(slot, &expected, q, memory_order_acq_rel, memory_order_acquire)) {
+		p2p_queue_free(q);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Marks a poll state's descriptor as readable.
+ */
+static void p2p_poll_state_signal(P2PPollState* state) {
+#ifdef __linux__
+	int fd = atomic_load_explicit(&state->eventFD, memory_order_acquire);
+	if(fd < 0 || atomic_exchange_explicit(&state->signaled, true, memory_order_acq_rel)) return;
+	uint64_t one = 1;
+	if(write(fd, &one, sizeof(one)) < 0) {} // Can only fail if the counter would overflow... in which case it is already readable!
+#endif
+}
+
+/**
+ * @brief Resets a poll state's descriptor so it only becomes readable again once something new is pushed.
+ * @note This needs to happen before the queues are drained so no push can slip by unnoticed.
+ */
+static void p2p_poll_state_clear(P2PPollState* state) {
+#ifdef __linux__
+	int fd = atomic_load_explicit(&state->eventFD, memory_order_acquire);
+	if(fd < 0) return;
+	atomic_store_explicit(&state->signaled, false, memory_order_release);
+	uint64_t count;
+	if(read(fd, &count, sizeof(count)) < 0) {} // Non-blocking, fails if nothing was signaled
+#endif
+}
+
+/**
+ * @brief Frees a poll state along with its queues and descriptor.
+ */
+static void p2p_poll_state_free(P2PPollState* state) {
+	if(state == NULL) return;
+	p2p_queue_free(atomic_load(&state->messages));
+	p2p_queue_free(atomic_load(&state->events));
+#ifdef __linux__
+	int fd = atomic_load(&state->eventFD);
+	if(fd >= 0) close(fd);
+#endif
+	free(state);
+}
+
+/**
+ * @brief Copies a field of a message into the tail of a queued message.
+ */
+static char* p2p_copy_field(char** cursor, const char* field, int size) {
+	char* out = *cursor;
+	memcpy(out, field, size);
+	out[size] = '\0';
+	*cursor += size + 1;
+	return out;
+}
+
+/**
+ * @brief Copies a message into a single allocation.
+ * @return The copy, or NULL if it couldn't be allocated.
+ */
+static P2PQueuedMessage* p2p_copy_message(const Message* m) {
+	size_t size = sizeof(P2PQueuedMessage) + m->from_size + m->data_size + m->seqno_size + m->topic_size
+		+ m->signature_size + m->key_size + m->id_size + m->recieved_from_size + 8;
+	P2PQueuedMessage* out = (P2PQueuedMessage*)malloc(size);
+	if(out == NULL) return NULL;
+	char* cursor = out->data;
+
+	P2PMessage* msg = &out->message;
+	msg->network = m->network;
+	msg->from = p2p_copy_field(&cursor, m->from, msg->from_size = m->from_size);
+	msg->data = p2p_copy_field(&cursor, m->data, msg->data_size = m->data_size);
+	msg->seqno = p2p_copy_field(&cursor, m->seqno, msg->seqno_size = m->seqno_size);
+	msg->topic = p2p_copy_field(&cursor, m->topic, msg->topic_size = m->topic_size);
+	msg->signature = p2p_copy_field(&cursor, m->signature, msg->signature_size = m->signature_size);
+	msg->key = p2p_copy_field(&cursor, m->key, msg->key_size = m->key_size);
+	msg->id = p2p_copy_field(&cursor, m->id, msg->id_size = m->id_size);
+	msg->received_from = p2p_copy_field(&cursor, m->recieved_from, msg->received_from_size = m->recieved_from_size);
+	msg->local = m->local;
+	msg->received_from_handle = m->recieved_from_handle;
+	return out;
+}
+
+/**
+ * @brief Bridges a batch of messages from Go into a message queue.
+ *
+ * This function copies each message and pushes it into the queue.
+ *
+ * @param state The poll state whose message queue should be pushed into.
+ * @param m The messages to push.
+ * @param count The number of messages in m.
+ * @return The number of messages consumed, less than count if the queue is full and blocks or memory runs out (Go should retry the rest later)
+ */
+int bridge_queue_messages(void* state, Message* m, int count) {
+	P2PPollState* st = (P2PPollState*)state;
+	P2PQueue* q = atomic_load_explicit(&st->messages, memory_order_acquire);
+	int i = 0;
+	for( ; i < count; i++) {
+		P2PQueuedMessage* copy = p2p_copy_message(m + i);
+		if(copy == NULL) break;
+		if(!p2p_queue_push(q, copy)) {
+			free(copy);
+			break;
+		}
+	}
+	if(i > 0) p2p_poll_state_signal(st);
+	return i;
+}
+
+/**
+ * @brief Bridges an event from Go into an event queue.
+ *
+ * @param state The poll state whose event queue should be pushed into.
+ * @param n The network the event occurred on.
+ * @param type The type of event.
+ * @param topic The topic the event refers to (or -1).
+ * @param peer The handle of the peer the event refers to (or -1).
+ * @param error The error the event reports (P2P_ERROR_NONE unless it is an error event).
+ * @param detail The ID of the peer the event refers to, or the description of the error (may be empty).
+ * @return False if the queue is full and blocks or memory runs out (Go should retry later)
+ */
+bool bridge_queue_event(void* state, P2PNetwork n, int type, P2PTopic topic, P2PPeer peer, int error, GoString detail) {
+	P2PPollState* st = (P2PPollState*)state;
+	P2PQueuedEvent* copy = (P2PQueuedEvent*)malloc(sizeof(P2PQueuedEvent) + detail.n + 1);
+	if(copy == NULL) return false;
+	copy->event.network = n;
+	copy->event.type = (P2PEventType)type;
+	copy->event.topic = topic;
+	copy->event.peer = copy->peer;
+	copy->event.peer_size = detail.n;
+	copy->event.peer_handle = peer;
+	copy->event.error = (P2PError)error;
+	memcpy(copy->peer, detail.p, detail.n);
+	copy->peer[detail.n] = '\0';
+
+	if(!p2p_queue_push(atomic_load_explicit(&st->events, memory_order_acquire), copy)) {
+		free(copy);
+		return false;
+	}
+	p2p_poll_state_signal(st);
+	return true;
 }
 
 /**
@@ -70,9 +610,35 @@ bool bridge_topic_callback(P2PNetwork n, int t, topic_callback f){
  * @note the data passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
  * @param network The network to manipulate.
  * @param callback The message callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
+ */
+void p2p_set_message_callback(P2PNetwork network, P2PMsgCallback callback, void* userData) {
+	setMessageCallback(network, (msg_callback)callback, userData);
+}
+
+/**
+ * @brief Sets the message batch callback function for P2P network.
+ *
+ * This function sets the message batch callback function for P2P network. It bridges the provided callback function from C to Go.
+ *
+ * @note the data passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
+ * @param network The network to manipulate.
+ * @param callback The message batch callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_message_callback(P2PNetwork network, P2PMsgCallback callback) {
-	setMessageCallback(network, (msg_callback)callback);
+void p2p_set_message_batch_callback(P2PNetwork network, P2PMsgBatchCallback callback, void* userData) {
+	setMessageBatchCallback(network, (msg_batch_callback)callback, userData);
+}
+
+/**
+ * @brief Sets how messages are grouped into batches for P2P network.
+ *
+ * @param network The network to manipulate.
+ * @param maxCount The maximum number of messages delivered in a single batch.
+ * @param maxLatency The time (in seconds) to wait for more messages once the already buffered ones have been gathered (0 never waits).
+ */
+void p2p_set_message_batch_limits(P2PNetwork network, int maxCount, double maxLatency) {
+	setMessageBatchLimits(network, maxCount, maxLatency);
 }
 
 /**
@@ -83,9 +649,10 @@ void p2p_set_message_callback(P2PNetwork network, P2PMsgCallback callback) {
  * @note the data passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
  * @param network The network to manipulate.
  * @param callback The peer connected callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_peer_connected_callback(P2PNetwork network, P2PPeerCallback callback) {
-	setPeerConnectedCallback(network, (peer_callback)callback);
+void p2p_set_peer_connected_callback(P2PNetwork network, P2PPeerCallback callback, void* userData) {
+	setPeerConnectedCallback(network, (peer_callback)callback, userData);
 }
 
 /**
@@ -96,9 +663,10 @@ void p2p_set_peer_connected_callback(P2PNetwork network, P2PPeerCallback callbac
  * @note the data passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
  * @param network The network to manipulate.
  * @param callback The peer disconnected callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_peer_disconnected_callback(P2PNetwork network, P2PPeerCallback callback) {
-	setPeerDisconnectedCallback(network, callback);
+void p2p_set_peer_disconnected_callback(P2PNetwork network, P2PPeerCallback callback, void* userData) {
+	setPeerDisconnectedCallback(network, callback, userData);
 }
 
 /**
@@ -108,9 +676,10 @@ void p2p_set_peer_disconnected_callback(P2PNetwork network, P2PPeerCallback call
  *
  * @param network The network to manipulate.
  * @param callback The topic subscribed callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_topic_subscribed_callback(P2PNetwork network, P2PTopicCallback callback) {
-	setTopicSubscribedCallback(network, callback);
+void p2p_set_topic_subscribed_callback(P2PNetwork network, P2PTopicCallback callback, void* userData) {
+	setTopicSubscribedCallback(network, callback, userData);
 }
 
 /**
@@ -120,9 +689,10 @@ void p2p_set_topic_subscribed_callback(P2PNetwork network, P2PTopicCallback call
  *
  * @param network The network to manipulate.
  * @param callback The topic unsubscribed callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_topic_unsubscribed_callback(P2PNetwork network, P2PTopicCallback callback) {
-	setTopicUnsubscribedCallback(network, callback);
+void p2p_set_topic_unsubscribed_callback(P2PNetwork network, P2PTopicCallback callback, void* userData) {
+	setTopicUnsubscribedCallback(network, callback, userData);
 }
 
 /**
@@ -132,9 +702,10 @@ void p2p_set_topic_unsubscribed_callback(P2PNetwork network, P2PTopicCallback ca
  *
  * @param network The network to manipulate.
  * @param callback The connected callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_connected_callback(P2PNetwork network, P2PVoidCallback callback) {
-	setConnectedCallback(network, callback);
+void p2p_set_connected_callback(P2PNetwork network, P2PVoidCallback callback, void* userData) {
+	setConnectedCallback(network, callback, userData);
 }
 
 /**
@@ -144,9 +715,53 @@ void p2p_set_connected_callback(P2PNetwork network, P2PVoidCallback callback) {
  *
  * @param network The network to manipulate.
  * @param callback The disconnected callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_disconnected_callback(P2PNetwork network, P2PVoidCallback callback) {
-	setDisconnectedCallback(network, callback);
+void p2p_set_disconnected_callback(P2PNetwork network, P2PVoidCallback callback, void* userData) {
+	setDisconnectedCallback(network, callback, userData);
+}
+
+/**
+ * @brief Sets the error callback function for P2P network.
+ *
+ * This function sets the error callback function for P2P network. It bridges the provided callback function from C to Go.
+ * The callback is invoked (from a background thread) when something goes wrong which the network can recover from, such as discovery not finding any peers within the connection timeout.
+ *
+ * @note the description passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
+ * @param network The network to manipulate.
+ * @param callback The error callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
+ */
+void p2p_set_error_callback(P2PNetwork network, P2PErrorCallback callback, void* userData) {
+	setErrorCallback(network, (error_callback)callback, userData);
+}
+
+/**
+ * @brief Sets the function the library's log messages (from every network) are delivered to.
+ *
+ * Messages are staged in a lock-free ring and delivered in batches from a background thread, identical messages
+ * repeated within a second are suppressed (the next record delivered for them reports how many were). If the callback
+ * can't keep up messages are dropped, a warning reporting how many is delivered once it catches up.
+ * Levels below the given one are never formatted, so turning logging off costs nothing.
+ * While no callback is set log messages are printed to stdout (everything if the network is verbose, otherwise only errors).
+ *
+ * @note the records passed to the callback are freed as soon as it returns... if you need them to stick around longer you must copy them!
+ * @param level The lowest level of message to deliver (P2P_LOG_OFF discards every message).
+ * @param callback The log callback function to set (NULL goes back to printing to stdout).
+ * @param userData Pointer passed back to the callback every time it is invoked.
+ */
+void p2p_set_log_callback(P2PLogLevel level, P2PLogCallback callback, void* userData) {
+	setLogCallback(level, (log_callback)callback, userData);
+}
+
+/**
+ * @brief Waits until every log message logged so far has been delivered to the log callback.
+ *
+ * Once it returns any log callback which has since been replaced is no longer in use, so its userData can be freed.
+ * @warning Must not be called from inside the log callback!
+ */
+void p2p_flush_log() {
+	flushLog();
 }
 
 /**
@@ -156,7 +771,18 @@ void p2p_set_disconnected_callback(P2PNetwork network, P2PVoidCallback callback)
  * @return true
  * @return false
  */
-bool p2p_network_valid(P2PNetwork network);
+bool p2p_network_valid(P2PNetwork network) {
+	return networkValid(network);
+}
+
+/**
+ * @brief Returns the id the next network to be initialized will get.
+ *
+ * @return the id of the next network to be created
+ */
+P2PNetwork p2p_next_network() {
+	return nextNetwork();
+}
 
 
 /**
@@ -263,6 +889,15 @@ P2PInitializationArguments p2p_default_initialize_args() {
 	out.connectionTimeout = 60 /*seconds*/;
 	out.fullyConnected = false;
 	out.verbose = false;
+	out.bootstrapPeers = NULL;
+	out.bootstrapPeersCount = 0;
+	out.disablePublicBootstrap = false;
+	out.discoveryMode = P2P_DISCOVERY_DHT;
+	out.targetPeerCount = 0;
+	out.simulation = 0;
+	out.connectedCallback = NULL;
+	out.errorCallback = NULL;
+	out.callbackUserData = NULL;
 	return out;
 }
 
@@ -288,6 +923,15 @@ P2PInitializationArguments p2p_initialize_args_from_strings(const char* listenAd
 	out.connectionTimeout = connectionTimeout;
 	out.fullyConnected = fullyConnected;
 	out.verbose = verbose;
+	out.bootstrapPeers = NULL;
+	out.bootstrapPeersCount = 0;
+	out.disablePublicBootstrap = false;
+	out.discoveryMode = P2P_DISCOVERY_DHT;
+	out.targetPeerCount = 0;
+	out.simulation = 0;
+	out.connectedCallback = NULL;
+	out.errorCallback = NULL;
+	out.callbackUserData = NULL;
 	return out;
 }
 
@@ -309,18 +953,143 @@ P2PTopic p2p_initialize(P2PInitializationArguments args) {
 	GoString key;
 	key.p = args.identity.data;
 	key.n = args.identity.size;
-	return initialize(listenAddress, discoveryTopic, key, args.connectionTimeout, args.fullyConnected, args.verbose);
+	return initialize(listenAddress, discoveryTopic, key, args.connectionTimeout, args.fullyConnected, args.verbose,
+		(char**)args.bootstrapPeers, args.bootstrapPeersCount, args.disablePublicBootstrap, args.discoveryMode, args.targetPeerCount, args.simulation,
+		(void_callback)args.connectedCallback, (error_callback)args.errorCallback, args.callbackUserData);
 }
 
 /**
  * @brief Shuts down P2P network.
  *
  * This function shuts down P2P network by calling the corresponding Go function.
+ * Any message or event queues are freed once the network has disconnected (the disconnected callback is invoked even if events are queued).
+ * Every background task of the network is stopped first, so no callback or queue is touched once this returns.
+ * @warning Must not be called from inside one of the network's callbacks (it waits for them to finish)!
  *
  * @param network The network to manipulate.
  */
 void p2p_shutdown(P2PNetwork network) {
-	shutdown(network);
+	// Shutdown waits for the recievers (and stops any more poll states from being installed), so nothing can be pushing anymore
+	P2PPollState* state = (P2PPollState*)shutdown(network);
+	_Atomic(P2PPollState*)* slot = p2p_poll_slot(network, false);
+	if(slot != NULL) atomic_store_explicit(slot, NULL, memory_order_release);
+	p2p_poll_state_free(state);
+}
+
+/**
+ * @brief Creates an in-process simulated network.
+ *
+ * Networks initialized with this simulation (see P2PInitializationArguments::simulation) run on libp2p's in-memory mocknet instead of real sockets, so hundreds of them can share one process.
+ * Every network in the simulation is linked to every other, with P2P_DISCOVERY_LOCAL treating the simulation as the local network (no mDNS or DHT traffic leaves the process).
+ * Identities (when none is provided), discovery, and message loss are derived from the seed so initializing the same networks in the same order reproduces the same simulation.
+ *
+ * @param defaults The options every link starts with.
+ * @param seed The seed for the simulation's random choices.
+ * @return The simulation.
+ */
+P2PSimulation p2p_create_simulation(P2PLinkOptions defaults, long long seed) {
+	return createSimulation(defaults.latency, defaults.bandwidth, defaults.loss, seed);
+}
+
+/**
+ * @brief Changes the link between two networks inside the same simulation.
+ *
+ * @param simulation The simulation both networks are running inside.
+ * @param a The network on one end of the link.
+ * @param b The network on the other end of the link.
+ * @param options The link's new latency, bandwidth, and loss.
+ * @return True if the link was changed, false if either network is invalid or not part of the simulation.
+ */
+bool p2p_set_link_options(P2PSimulation simulation, P2PNetwork a, P2PNetwork b, P2PLinkOptions options) {
+	return setLinkOptions(simulation, a, b, options.latency, options.bandwidth, options.loss);
+}
+
+/**
+ * @brief Destroys a simulation.
+ *
+ * @note Every network running inside the simulation should be shutdown first!
+ * @param simulation The simulation to destroy.
+ */
+void p2p_destroy_simulation(P2PSimulation simulation) {
+	destroySimulation(simulation);
+}
+
+/**
+ * @brief Connects directly to a peer, bypassing discovery.
+ *
+ * This function dials the peer at the given multiaddr (which must include its /p2p/ peer ID) and blocks until the connection succeeds or the dial timeout (see p2p_configure_dialer()) elapses.
+ * If this is the first peer the network has connected to, the connected callback fires immediately instead of waiting for discovery.
+ *
+ * @param network The network to manipulate.
+ * @param multiaddr The peer's multiaddr (e.g. "/ip4/192.168.1.2/udp/4001/quic-v1/p2p/12D3KooW...").
+ * @return True if the connection succeeded, false otherwise.
+ */
+bool p2p_connect_peer(P2PNetwork network, const char* multiaddr) {
+	return p2p_connect_peern(network, multiaddr, strlen(multiaddr));
+}
+
+/**
+ * @brief Connects directly to a peer, bypassing discovery.
+ *
+ * This function dials the peer at the given multiaddr (which must include its /p2p/ peer ID) and blocks until the connection succeeds or the dial timeout (see p2p_configure_dialer()) elapses.
+ * If this is the first peer the network has connected to, the connected callback fires immediately instead of waiting for discovery.
+ *
+ * @param network The network to manipulate.
+ * @param multiaddr The peer's multiaddr.
+ * @param multiaddrSize The length of the multiaddr.
+ * @return True if the connection succeeded, false otherwise.
+ */
+bool p2p_connect_peern(P2PNetwork network, const char* multiaddr, int multiaddrSize) {
+	GoString m;
+	m.p = multiaddr;
+	m.n = multiaddrSize;
+	return connectPeer(network, m);
+}
+
+/**
+ * @brief Connects directly to several peers in parallel, bypassing discovery.
+ *
+ * This function dials the multiaddrs in parallel (up to the dial concurrency limit) and blocks until all of them have connected or failed.
+ * The connected callback fires as soon as the first connection succeeds (if the network wasn't already connected).
+ * Multiaddrs of a peer which is already being dialed (by this call or anything else) wait for that dial and share its result.
+ *
+ * @param network The network to manipulate.
+ * @param multiaddrs Array of peer multiaddrs.
+ * @param count The number of multiaddrs.
+ * @param results Optional (may be NULL) array of count bools recording whether each connection succeeded.
+ * @return The number of peers successfully connected to.
+ */
+int p2p_connect_peers(P2PNetwork network, const char* const* multiaddrs, int count, bool* results) {
+	return connectPeers(network, (char**)multiaddrs, count, results);
+}
+
+/**
+ * @brief Configures how many peers the network dials at once, and how long each dial may take.
+ *
+ * Discovery can turn up hundreds of candidate peers at once, dialing them all together causes connection storms and file descriptor spikes.
+ * Instead at most maxConcurrentDials are in flight (candidates with the lowest previously measured round trip time are dialed first, and peers which are already connected are skipped).
+ * May be called before the network is initialized (see p2p_next_network()).
+ *
+ * @param network The network to manipulate.
+ * @param maxConcurrentDials The maximum number of dials in progress at once (the default is 8).
+ * @param dialTimeout The time in seconds a single dial may take before it is abandoned (the default is 15).
+ * @return True if the dialer was configured, false if the network is invalid or the arguments are out of range.
+ */
+bool p2p_configure_dialer(P2PNetwork network, int maxConcurrentDials, double dialTimeout) {
+	return configureDialer(network, maxConcurrentDials, dialTimeout);
+}
+
+/**
+ * @brief Gets how quickly the network's discovery has found its peers.
+ *
+ * Discovery keeps running in the background after the first peer is found, until targetPeerCount peers are connected (and again whenever peers are lost).
+ *
+ * @param network The network to query.
+ * @param out Filled with the network's discovery metrics.
+ * @return True if the metrics were filled in, false if the network is invalid.
+ */
+bool p2p_discovery_metrics(P2PNetwork network, P2PDiscoveryMetrics* out) {
+	return discoveryMetrics(network, (DiscoveryMetrics*)out);
 }
 
 /**
@@ -336,6 +1105,51 @@ char* p2p_local_id(P2PNetwork network) {
 	return localID(network);
 }
 
+/**
+ * @brief Returns the multiaddrs the network is listening on (including our /p2p/ peer ID) so other nodes can connect to us directly.
+ *
+ * This function returns the network's listen addresses separated by newlines, each of which can be passed to p2p_connect_peer() on another node.
+ *
+ * @note This pointer is heap allocated and must be freed by the caller!
+ * @param network The network to query.
+ * @return The listen addresses (NULL if the network is invalid).
+ */
+char* p2p_listen_addresses(P2PNetwork network) {
+	return listenAddresses(network);
+}
+
+/**
+ * @brief Looks up the ID of a peer from its handle.
+ *
+ * Interned IDs are kept by the library, so this doesn't allocate.
+ *
+ * @param network The network the handle belongs to.
+ * @param peer The handle of the peer.
+ * @param size Set to the length of the ID (may be NULL, the ID is also null terminated but may contain embedded nulls).
+ * @note The returned pointer is owned by the library and stays valid until the network is shutdown.
+ * @return The ID of the peer, or NULL if the handle is invalid.
+ */
+const char* p2p_peer_id(P2PNetwork network, P2PPeer peer, int* size) {
+	return peerID(network, peer, size);
+}
+
+/**
+ * @brief Gets the handle of a peer from its ID.
+ *
+ * Handles are only assigned to peers the network has heard from (through peer events or messages), and stay assigned until the network is shutdown.
+ *
+ * @param network The network to manipulate.
+ * @param id The ID of the peer.
+ * @param idSize The length of id.
+ * @return The handle of the peer, or -1 if the network is invalid or hasn't seen the peer.
+ */
+P2PPeer p2p_peer_handle(P2PNetwork network, const char* id, int idSize) {
+	GoString i;
+	i.p = id;
+	i.n = idSize;
+	return peerHandle(network, i);
+}
+
 /**
  * @brief Subscribes to a topic with the provided name limiting the string's size.
  *
@@ -423,6 +1237,37 @@ bool p2p_leave_topic(P2PNetwork network, P2PTopic topicID) {
 	return leaveTopic(network, topicID);
 }
 
+/**
+ * @brief Lists the peers currently in a topic, copying a snapshot of their IDs into caller provided buffers in a single call (without any allocations).
+ *
+ * Each peer ID is copied into buf followed by a null terminator, offsets[i] is where the i-th ID starts and offsets[count] is where the last one ends (so the size of the i-th ID is offsets[i + 1] - offsets[i] - 1).
+ * If the peers don't all fit nothing useful is written and minus the number of peers is returned, so the buffers can be grown before trying again.
+ *
+ * @param network The network to query.
+ * @param topic The topic whose peers should be listed.
+ * @param buf Buffer the peer IDs are copied into.
+ * @param bufSize The size of buf.
+ * @param offsets Array (with room for maxPeers + 1 entries) filled with where each peer ID starts in buf.
+ * @param maxPeers The maximum number of peers which can be listed.
+ * @return The number of peers in the topic (0 if the network or topic is invalid), negated if they didn't fit in the buffers.
+ */
+int p2p_list_peers(P2PNetwork network, P2PTopic topic, char* buf, int bufSize, int* offsets, int maxPeers) {
+	return listPeers(network, topic, buf, bufSize, offsets, maxPeers);
+}
+
+/**
+ * @brief Gets a counter which changes every time the peers in a topic change.
+ *
+ * Callers holding a snapshot from p2p_list_peers() can compare this against the version they took it at and skip listing the peers again if it hasn't changed.
+ *
+ * @param network The network to query.
+ * @param topic The topic to check.
+ * @return The version of the topic's peer list, or -1 if the network or topic is invalid.
+ */
+long long p2p_peer_list_version(P2PNetwork network, P2PTopic topic) {
+	return peerListVersion(network, topic);
+}
+
 /**
  * @brief Broadcasts a message to the specified P2P topic with the provided message limited to size.
  *
@@ -455,6 +1300,357 @@ bool p2p_broadcast_message(P2PNetwork network, const char* message, P2PTopic top
 	return p2p_broadcast_messagen(network, message, strlen(message), topicID);
 }
 
+/**
+ * @brief Allocates a library owned buffer which can be filled and then broadcast without being copied.
+ *
+ * This function allocates a buffer by calling the corresponding Go function, the buffer must be passed to either p2p_broadcast_buffer() or p2p_release_buffer().
+ *
+ * @param size The size of the buffer.
+ * @return Pointer to the buffer (NULL if size isn't positive).
+ */
+char* p2p_acquire_buffer(int size) {
+	return acquireBuffer(size);
+}
+
+/**
+ * @brief Returns a buffer allocated by p2p_acquire_buffer() without broadcasting it.
+ *
+ * @param buffer The buffer to release.
+ */
+void p2p_release_buffer(char* buffer) {
+	releaseBuffer(buffer);
+}
+
+/**
+ * @brief Broadcasts the contents of a buffer allocated by p2p_acquire_buffer() to the specified P2P topic without copying it.
+ *
+ * This function hands the buffer to the corresponding Go function, which consumes it (even if the broadcast fails).
+ *
+ * @param network The network to manipulate.
+ * @param buffer The buffer to broadcast.
+ * @param messageSize The number of bytes of the buffer to broadcast.
+ * @param topicID The P2P topic ID to broadcast the message to.
+ * @return True if the message was successfully broadcasted, false otherwise.
+ */
+bool p2p_broadcast_buffer(P2PNetwork network, char* buffer, int messageSize, P2PTopic topicID) {
+	return broadcastBuffer(network, buffer, messageSize, topicID);
+}
+
+/**
+ * @brief Broadcasts a batch of messages, each to its own P2P topic.
+ *
+ * This function broadcasts every message in the batch with a single call to the corresponding Go function.
+ *
+ * @param network The network to manipulate.
+ * @param messages The messages (and the topics they should be broadcast to) to broadcast.
+ * @param count The number of messages.
+ * @param results Optional array of count bools, set to whether or not each message was successfully broadcasted (may be NULL).
+ * @return The number of messages which were successfully broadcasted.
+ */
+int p2p_broadcast_messages(P2PNetwork network, const P2POutMessage* messages, int count, bool* results) {
+	return broadcastMessages(network, (OutMessage*)messages, count, results);
+}
+
+/**
+ * @brief Queues a message to be broadcast to the specified P2P topic without waiting for it to be published.
+ *
+ * The message is copied into a bounded per-network queue which is drained by a pool of worker threads.
+ *
+ * @param network The network to manipulate.
+ * @param message The message to broadcast.
+ * @param messageSize The size of the message.
+ * @param topicID The P2P topic ID to broadcast the message to.
+ * @param callback Optional function invoked (on a worker thread) once the message has been published (or failed to be).
+ * @param userData Pointer passed through to callback.
+ * @return P2P_PUBLISH_QUEUED if the message was queued (callback will be invoked), otherwise the reason it wasn't (callback won't be invoked).
+ */
+P2PPublishStatus p2p_broadcast_message_async(P2PNetwork network, const char* message, int messageSize, P2PTopic topicID, P2PPublishCallback callback, void* userData) {
+	return (P2PPublishStatus)broadcastMessageAsync(network, (char*)message, messageSize, topicID, (publish_callback)callback, userData);
+}
+
+/**
+ * @brief Configures the queue used by p2p_broadcast_message_async() for P2P network.
+ *
+ * @param network The network to manipulate.
+ * @param depth The maximum number of messages that can be waiting to be published.
+ * @param workers The number of worker threads publishing messages.
+ * @param highWatermark Once this many messages are waiting new messages are rejected with P2P_PUBLISH_BACKPRESSURE...
+ * @param lowWatermark ... until the queue drains back down to this many messages.
+ * @return False if messages have already been published asynchronously (the configuration can no longer be changed).
+ */
+bool p2p_configure_async_publish(P2PNetwork network, int depth, int workers, int highWatermark, int lowWatermark) {
+	return configureAsyncPublish(network, depth, workers, highWatermark, lowWatermark);
+}
+
+/**
+ * @brief Returns the number of messages waiting to be published asynchronously by P2P network.
+ *
+ * @param network The network to query.
+ * @return The number of queued messages.
+ */
+int p2p_async_publish_queue_depth(P2PNetwork network) {
+	return publishQueueDepth(network);
+}
+
+/**
+ * @brief Switches P2P network to queuing incoming messages for polling instead of invoking the message callbacks.
+ *
+ * @param network The network to manipulate.
+ * @param capacity The number of messages the queue can hold (rounded up to a power of two).
+ * @param policy What to do when a message arrives and the queue is full.
+ * @return True if the queue was enabled, false if the network already has one (or has been shutdown).
+ */
+bool p2p_enable_message_queue(P2PNetwork network, int capacity, P2POverflowPolicy policy) {
+	P2PPollState* state = p2p_poll_state(network);
+	if(state == NULL || !p2p_poll_state_claim(&state->messages, capacity, policy)) return false;
+	return enablePollQueue(network, false);
+}
+
+/**
+ * @brief Removes up to max messages from the front of P2P network's message queue.
+ *
+ * @note The messages stay valid until the next call to this function (or the network is shutdown), this function must not be called from multiple threads at once!
+ * @param network The network to manipulate.
+ * @param out Array of at least max messages to fill.
+ * @param max The maximum number of messages to remove.
+ * @return The number of messages written to out, or -1 if the network has no message queue (or there wasn't enough memory to hold max messages).
+ */
+int p2p_poll_messages(P2PNetwork network, P2PMessage* out, int max) {
+	P2PPollState* state = p2p_find_poll_state(network);
+	P2PQueue* q = state != NULL ? atomic_load_explicit(&state->messages, memory_order_acquire) : NULL;
+	if(q == NULL) return -1;
+
+	p2p_poll_state_clear(state);
+	if(!p2p_queue_release_held(q, max)) return -1;
+	int count = 0;
+	for(void* item; count < max && (item = p2p_queue_try_pop(q)) != NULL; count++) {
+		q->held[count] = item;
+		out[count] = ((P2PQueuedMessage*)item)->message;
+	}
+	q->heldCount = count;
+	return count;
+}
+
+/**
+ * @brief Returns the number of messages P2P network's message queue has dropped because it was full.
+ *
+ * @param network The network to query.
+ * @return The number of dropped messages (0 if the network has no message queue).
+ */
+unsigned long long p2p_message_queue_dropped(P2PNetwork network) {
+	P2PPollState* state = p2p_find_poll_state(network);
+	P2PQueue* q = state != NULL ? atomic_load_explicit(&state->messages, memory_order_acquire) : NULL;
+	if(q == NULL) return 0;
+	return atomic_load_explicit(&q->dropped, memory_order_relaxed);
+}
+
+/**
+ * @brief Gets a network's runtime statistics.
+ *
+ * The counters are updated atomically on the hot paths (so they are always cheap to keep), but separate counters aren't read as one consistent snapshot.
+ *
+ * @param network The network to query.
+ * @param out Filled with the network's statistics.
+ * @return True if the statistics were filled in, false if the network is invalid.
+ */
+bool p2p_get_stats(P2PNetwork network, P2PStats* out) {
+	if(!getStats(network, (Stats*)out)) return false;
+
+	P2PPollState* state = p2p_find_poll_state(network);
+	out->queued_messages = 0;
+	out->dropped_messages = 0;
+	P2PQueue* q = state != NULL ? atomic_load_explicit(&state->messages, memory_order_acquire) : NULL;
+	if(q != NULL) {
+		out->queued_messages = (int)(atomic_load_explicit(&q->enqueuePos, memory_order_relaxed) - atomic_load_explicit(&q->dequeuePos, memory_order_relaxed));
+		out->dropped_messages = atomic_load_explicit(&q->dropped, memory_order_relaxed);
+	}
+	return true;
+}
+
+/**
+ * @brief Gets the traffic statistics of one of a network's topics.
+ *
+ * @param network The network to query.
+ * @param topic The topic to query.
+ * @param out Filled with the topic's statistics.
+ * @return True if the statistics were filled in, false if the network or topic is invalid.
+ */
+bool p2p_get_topic_stats(P2PNetwork network, P2PTopic topic, P2PTopicStats* out) {
+	return getTopicStats(network, topic, (TopicStats*)out);
+}
+
+/**
+ * @brief Enables or disables latency tracking.
+ *
+ * While enabled the network stamps a small header (12 bytes) holding the wall-clock publish time on every message it publishes, and records the latency of every stamped message it receives from others into a per topic histogram (see p2p_get_latency_stats()).
+ * The header is removed before messages are delivered, so the application's payloads are unchanged, but only while tracking is enabled (so payloads which happen to look stamped are left alone).
+ * Every network sharing a topic should therefore enable (or disable) tracking together, otherwise those which aren't tracking receive the header as part of the payload.
+ * Latencies between machines include the difference between their clocks.
+ *
+ * @note Can be called before the network is initialized (with the ID from p2p_next_network()).
+ * @param network The network to manipulate.
+ * @param enable Whether latency should be tracked.
+ */
+void p2p_set_latency_tracking(P2PNetwork network, bool enable) {
+	setLatencyTracking(network, enable);
+}
+
+/**
+ * @brief Summarizes the publish to delivery latencies recorded for a topic.
+ *
+ * @param network The network to query.
+ * @param topic The topic to query.
+ * @param out Filled with the summary.
+ * @param reset Whether to clear the recorded latencies afterwards, so periodic dumps each only cover their own interval.
+ * @return True if the summary was filled in, false if the network or topic is invalid.
+ */
+bool p2p_get_latency_stats(P2PNetwork network, P2PTopic topic, P2PLatencyStats* out, bool reset) {
+	return latencyStats(network, topic, (LatencyStats*)out, reset);
+}
+
+/**
+ * @brief Gets how long calls into the application's callbacks have taken, to tell the library's cost from the application's.
+ *
+ * The profile covers every network in the process.
+ *
+ * @param out Filled with the profile.
+ * @param reset Whether to clear the profile afterwards, so periodic dumps each only cover their own interval.
+ */
+void p2p_get_callback_profile(P2PCallbackProfile* out, bool reset) {
+	getCallbackProfile((CallbackProfile*)out, reset);
+	for(int kind = 0; kind < P2P_CALLBACK_KIND_COUNT; kind++) {
+		unsigned long long nanoseconds = reset ? atomic_exchange_explicit(&p2p_callback_nanoseconds[kind], 0, memory_order_relaxed)
+			: atomic_load_explicit(&p2p_callback_nanoseconds[kind], memory_order_relaxed);
+		out->callback_time[kind] = nanoseconds / 1e9;
+	}
+}
+
+/**
+ * @brief Starts writing a CPU profile of the library's Go runtime to a file.
+ *
+ * The profile is in the standard pprof format (view it with `go tool pprof`), it keeps being written until p2p_stop_cpu_profile() is called.
+ *
+ * @param path The file to write the profile to.
+ * @return True if profiling started, false if the file couldn't be created or a profile is already running.
+ */
+bool p2p_start_cpu_profile(const char* path) {
+	GoString go;
+	go.p = path;
+	go.n = strlen(path);
+	return startCPUProfile(go);
+}
+
+/**
+ * @brief Stops the running CPU profile and finishes writing it.
+ *
+ * @return True if a profile was stopped and written, false otherwise.
+ */
+bool p2p_stop_cpu_profile() {
+	return stopCPUProfile();
+}
+
+/**
+ * @brief Writes a heap profile of the library's Go runtime to a file.
+ *
+ * The profile is in the standard pprof format (view it with `go tool pprof`).
+ *
+ * @param path The file to write the profile to.
+ * @return True if the profile was written, false otherwise.
+ */
+bool p2p_write_heap_profile(const char* path) {
+	GoString go;
+	go.p = path;
+	go.n = strlen(path);
+	return writeHeapProfile(go);
+}
+
+/**
+ * @brief Writes the stacks of every goroutine in the library's Go runtime to a file.
+ *
+ * The dump is in the standard pprof format (view it with `go tool pprof`, `-traces` lists every stack).
+ *
+ * @param path The file to write the dump to.
+ * @return True if the dump was written, false otherwise.
+ */
+bool p2p_write_goroutine_dump(const char* path) {
+	GoString go;
+	go.p = path;
+	go.n = strlen(path);
+	return writeGoroutineDump(go);
+}
+
+/**
+ * @brief Switches P2P network to queuing peer, topic, and connection events for polling instead of invoking their callbacks.
+ *
+ * @note The queue is freed by p2p_shutdown, so the final P2P_EVENT_DISCONNECTED is still passed to the disconnected callback.
+ * @param network The network to manipulate.
+ * @param capacity The number of events the queue can hold (rounded up to a power of two).
+ * @param policy What to do when an event occurs and the queue is full.
+ * @return True if the queue was enabled, false if the network already has one (or has been shutdown).
+ */
+bool p2p_enable_event_queue(P2PNetwork network, int capacity, P2POverflowPolicy policy) {
+	P2PPollState* state = p2p_poll_state(network);
+	if(state == NULL || !p2p_poll_state_claim(&state->events, capacity, policy)) return false;
+	return enablePollQueue(network, true);
+}
+
+/**
+ * @brief Removes up to max events from the front of P2P network's event queue.
+ *
+ * @note The events stay valid until the next call to this function (or the network is shutdown), this function must not be called from multiple threads at once!
+ * @param network The network to manipulate.
+ * @param out Array of at least max events to fill.
+ * @param max The maximum number of events to remove.
+ * @return The number of events written to out, or -1 if the network has no event queue (or there wasn't enough memory to hold max events).
+ */
+int p2p_poll_events(P2PNetwork network, P2PEvent* out, int max) {
+	P2PPollState* state = p2p_find_poll_state(network);
+	P2PQueue* q = state != NULL ? atomic_load_explicit(&state->events, memory_order_acquire) : NULL;
+	if(q == NULL) return -1;
+
+	p2p_poll_state_clear(state);
+	if(!p2p_queue_release_held(q, max)) return -1;
+	int count = 0;
+	for(void* item; count < max && (item = p2p_queue_try_pop(q)) != NULL; count++) {
+		q->held[count] = item;
+		out[count] = ((P2PQueuedEvent*)item)->event;
+	}
+	q->heldCount = count;
+	return count;
+}
+
+/**
+ * @brief Returns a descriptor which becomes readable whenever P2P network has queued messages or events waiting to be polled.
+ *
+ * @note Enables the event queue (holding 1024 events and dropping the oldest when full) if it hasn't already been enabled.
+ * @param network The network to manipulate.
+ * @return The descriptor, or -1 if it couldn't be created (or the platform doesn't support eventfd).
+ */
+int p2p_event_fd(P2PNetwork network) {
+#ifdef __linux__
+	P2PPollState* state = p2p_poll_state(network);
+	if(state == NULL) return -1;
+	int fd = atomic_load_explicit(&state->eventFD, memory_order_acquire);
+	if(fd >= 0) return fd;
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(fd < 0) return -1;
+	int expected = -1;
+	if(!atomic_compare_exchange_strong_explicit(&state->eventFD, &expected, fd, memory_order_acq_rel, memory_order_acquire)) {
+		close(fd); // Another thread created one first, share theirs
+		return expected;
+	}
+	if(atomic_load_explicit(&state->events, memory_order_acquire) == NULL)
+		p2p_enable_event_queue(network, 1024, P2P_OVERFLOW_DROP_OLDEST);
+
+	// Anything queued before the descriptor existed still needs to be noticed
+	p2p_poll_state_signal(state);
+	return fd;
+#else
+	return -1;
+#endif
+}
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
\ No newline at end of file
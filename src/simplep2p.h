@@ -13,36 +13,161 @@ extern "C" {
  */
 typedef int P2PNetwork;
 
+/**
+ * @typedef P2PPeer
+ * @brief Alias for a handle to a peer.
+ *
+ * Every peer a network sees is interned into a dense handle (counting up from 0, which is always the local peer) which is never reused while the network is running.
+ * Per peer state can thus be indexed with flat arrays instead of hashing peer IDs, use p2p_peer_id() to get the ID back.
+ */
+typedef int P2PPeer;
+
+/**
+ * @typedef P2PSimulation
+ * @brief Alias for an in-process simulated network, see p2p_create_simulation().
+ */
+typedef int P2PSimulation;
+
 /**
  * @struct P2PMessage
  * @brief Structure representing a P2P message.
  *
  * This structure holds the fields of a P2P message, including 'from', 'data', 'seqno', 'topic', 'signature', 'key', 'id', and 'received_from'.
+ * Every field is null terminated, but may also contain embedded nulls, so its accompanying size should be preferred.
  */
 typedef struct {
 	P2PNetwork network;
 	char* from;             ///< ???
+	int from_size;          ///< The length of from.
 	char* data;             ///< The content of the message.
+	int data_size;          ///< The length of data.
 	char* seqno;            ///< The sequence number of the message.
+	int seqno_size;         ///< The length of seqno.
 	char* topic;            ///< The topic of the message.
+	int topic_size;         ///< The length of topic.
 	char* signature;        ///< ???
+	int signature_size;     ///< The length of signature.
 	char* key;              ///< The key of the message.
+	int key_size;           ///< The length of key.
 	char* id;               ///< The ID of the message.
+	int id_size;            ///< The length of id.
 	char* received_from;    ///< The sender of the message.
+	int received_from_size; ///< The length of received_from.
+	bool local;             ///< True if the message was sent by the local node.
+	P2PPeer received_from_handle; ///< The handle of the sender of the message.
 } P2PMessage;
 
+/**
+ * @enum P2POverflowPolicy
+ * @brief What a message queue should do when a message arrives while it is full.
+ */
+typedef enum {
+	P2P_OVERFLOW_DROP_OLDEST,   ///< Discard the oldest queued message to make room.
+	P2P_OVERFLOW_DROP_NEWEST,   ///< Discard the incoming message.
+	P2P_OVERFLOW_BLOCK,         ///< Stop recieving on the message's topic until space is available.
+} P2POverflowPolicy;
+
 /**
  * @typedef P2PTopic
  * @brief Alias for the P2P topic.
  */
 typedef int P2PTopic;
 
+/**
+ * @struct P2POutMessage
+ * @brief Structure representing a message to be broadcast as part of a batch.
+ */
+typedef struct {
+	const char* data;       ///< The content of the message.
+	int size;               ///< The length of data.
+	P2PTopic topic;         ///< The topic to broadcast the message to.
+} P2POutMessage;
+
+/**
+ * @enum P2PEventType
+ * @brief The kinds of events which can be polled from an event queue.
+ */
+typedef enum {
+	P2P_EVENT_PEER_CONNECTED,       ///< A peer connected (peer is set).
+	P2P_EVENT_PEER_DISCONNECTED,    ///< A peer disconnected (peer is set).
+	P2P_EVENT_TOPIC_SUBSCRIBED,     ///< A topic was subscribed to (topic is set).
+	P2P_EVENT_TOPIC_UNSUBSCRIBED,   ///< A topic was unsubscribed from (topic is set).
+	P2P_EVENT_CONNECTED,            ///< The network finished connecting.
+	P2P_EVENT_DISCONNECTED,         ///< The network disconnected (never queued by shutdown, which frees the queues, so it always reaches the disconnected callback).
+	P2P_EVENT_ERROR,                ///< Something went wrong in the background (error is set and peer holds a description).
+} P2PEventType;
+
+/**
+ * @enum P2PError
+ * @brief The kinds of errors reported to the error callback.
+ */
+typedef enum {
+	P2P_ERROR_NONE,                 ///< No error.
+	P2P_ERROR_DISCOVERY_TIMEOUT,    ///< No peer was found within the connection timeout, discovery keeps searching in the background.
+	P2P_ERROR_DISCOVERY,            ///< A discovery mechanism failed (e.g. the DHT couldn't be bootstrapped or searched).
+} P2PError;
+
+/**
+ * @struct P2PEvent
+ * @brief Structure representing a peer, topic, or connection event polled from an event queue.
+ */
+typedef struct {
+	P2PNetwork network;
+	P2PEventType type;      ///< What happened.
+	P2PTopic topic;         ///< The topic the event refers to (-1 if it doesn't refer to a topic).
+	char* peer;             ///< The peer the event refers to (empty if it doesn't refer to a peer), or the description of an error.
+	int peer_size;          ///< The length of peer.
+	P2PPeer peer_handle;    ///< The handle of the peer the event refers to (-1 if it doesn't refer to a peer).
+	P2PError error;         ///< The error which occurred (P2P_ERROR_NONE unless type is P2P_EVENT_ERROR).
+} P2PEvent;
+
 
 // Definitions of the callback types used by the callback functions
-typedef bool (*P2PMsgCallback)(P2PNetwork, P2PMessage*);
-typedef bool (*P2PVoidCallback)(P2PNetwork);
-typedef bool (*P2PPeerCallback)(P2PNetwork, char*);
-typedef bool (*P2PTopicCallback)(P2PNetwork, P2PTopic);
+// NOTE: every callback is passed the userData pointer it was set alongside as its final argument
+typedef bool (*P2PMsgCallback)(P2PNetwork, P2PMessage*, void* userData);
+typedef bool (*P2PMsgBatchCallback)(P2PNetwork, P2PMessage*, int count, void* userData);
+typedef bool (*P2PVoidCallback)(P2PNetwork, void* userData);
+typedef bool (*P2PPeerCallback)(P2PNetwork, char*, P2PPeer, void* userData);
+typedef bool (*P2PTopicCallback)(P2PNetwork, P2PTopic, void* userData);
+typedef bool (*P2PPublishCallback)(P2PNetwork, bool success, void* userData);
+typedef bool (*P2PErrorCallback)(P2PNetwork, P2PError, char* description, void* userData);
+
+/**
+ * @enum P2PLogLevel
+ * @brief Enumeration of the severities of the library's log messages.
+ */
+typedef enum {
+	P2P_LOG_DEBUG,   ///< Detailed information about what the library is doing, such as every peer connected to.
+	P2P_LOG_INFO,    ///< Milestones, such as discovery finding its first peer.
+	P2P_LOG_WARNING, ///< Something failed which the library (or application) can recover from, such as a failed publish.
+	P2P_LOG_ERROR,   ///< Something failed which the application should fix, such as an invalid bootstrap peer.
+	P2P_LOG_OFF      ///< Used as a level to not log anything.
+} P2PLogLevel;
+
+/**
+ * @struct P2PLogRecord
+ * @brief Structure representing a log message passed to the log callback.
+ */
+typedef struct {
+	P2PLogLevel level;     ///< The severity of the message.
+	P2PNetwork network;    ///< The network the message is about (-1 if it isn't about a particular network).
+	double time;           ///< When the message was logged (in seconds since the Unix epoch).
+	unsigned int repeated; ///< How many identical messages were suppressed since this one was last delivered (0 if this is its first delivery).
+	char* message;         ///< The message (null terminated).
+	int message_size;      ///< The length of message.
+} P2PLogRecord;
+
+typedef void (*P2PLogCallback)(P2PLogRecord* records, int count, void* userData);
+
+/**
+ * @enum P2PPublishStatus
+ * @brief The result of queuing a message with p2p_broadcast_message_async().
+ */
+typedef enum {
+	P2P_PUBLISH_QUEUED,         ///< The message was queued, its callback will be invoked once it has been published.
+	P2P_PUBLISH_BACKPRESSURE,   ///< The queue is above its high watermark, try again once it has drained.
+	P2P_PUBLISH_FAILED,         ///< The network or topic is invalid.
+} P2PPublishStatus;
 
 
 /**
@@ -65,6 +190,16 @@ typedef P2PKey P2PString;
  */
 inline P2PNetwork p2p_initial_network() { return 0; }
 
+/**
+ * @brief Returns the id the next network to be initialized will get
+ *
+ * Network ids are never reused, so this can be used to set callbacks (or enable queues) for a network before it is initialized.
+ * @note If several threads initialize networks at once the id may be claimed by another thread's network! (P2PInitializationArguments can carry the connected and error callbacks instead)
+ *
+ * @return the id of the next network to be created
+ */
+P2PNetwork p2p_next_network();
+
 /**
  * @brief Checks if the given network ID is (still) valid (has been created and has not been shutdown)!
  *
@@ -137,11 +272,22 @@ P2PKey p2p_generate_key();
 P2PKey p2p_null_key();
 
 
+/**
+ * @enum P2PDiscoveryMode
+ * @brief How a network finds its first peers.
+ */
+typedef enum {
+	P2P_DISCOVERY_DHT,   ///< Advertise and search for peers on a DHT bootstrapped from the bootstrap peers (and the public IPFS bootstrap peers unless disabled).
+	P2P_DISCOVERY_LOCAL, ///< Connect directly to the bootstrap peers and search the local network using mDNS, no DHT is started (no internet access needed).
+	P2P_DISCOVERY_ALL,   ///< Do both of the above at once, whichever connects to a peer first wins.
+} P2PDiscoveryMode;
+
 /**
  * @struct P2PInitializationArguments
  * @brief Structure representing the initialization arguments for P2P networking.
  *
  * This structure holds the initialization arguments for P2P networking, including the listen address, listen address size, discovery topic, discovery topic size, P2P key identity, and verbose flag.
+ * Fields which are zeroed keep their default behavior, so it is recommended to start from p2p_default_initialize_args().
  */
 typedef struct {
 	const char* listenAddress;          ///< The listen address.
@@ -149,11 +295,119 @@ typedef struct {
 	const char* discoveryTopic;         ///< The discovery topic.
 	long long discoveryTopicSize;       ///< The size of the discovery topic.
 	P2PKey identity;                    ///< The P2P key identity.
-	double connectionTimeout;			///< The time in seconds to try connecting before giving up
+	double connectionTimeout;			///< The time in seconds to wait for the first peer before reporting P2P_ERROR_DISCOVERY_TIMEOUT (discovery keeps searching)
 	bool fullyConnected;				///< Weather every message should be sent to every peer, or if the network should be more intelligent
 	bool verbose;                       ///< The verbose flag.
+	const char* const* bootstrapPeers;  ///< Array of null terminated multiaddrs (including a /p2p/ peer ID) of peers to bootstrap from (may be NULL).
+	int bootstrapPeersCount;            ///< The number of bootstrap peers.
+	bool disablePublicBootstrap;        ///< Don't bootstrap from the public IPFS bootstrap peers (for networks without internet access).
+	P2PDiscoveryMode discoveryMode;     ///< How peers are discovered.
+	int targetPeerCount;                ///< Discovery keeps searching in the background until this many peers are connected (0 uses the default of 8).
+	P2PSimulation simulation;           ///< Run the network inside this simulation (see p2p_create_simulation()) instead of on real sockets, 0 for none.
+	P2PVoidCallback connectedCallback;  ///< Connected callback set before the network starts (NULL keeps any set ahead of time), unlike configuring p2p_next_network() this can't race with other threads initializing networks.
+	P2PErrorCallback errorCallback;     ///< Error callback set before the network starts (NULL keeps any set ahead of time).
+	void* callbackUserData;             ///< Pointer passed back to connectedCallback and errorCallback.
 } P2PInitializationArguments;
 
+/**
+ * @struct P2PDiscoveryMetrics
+ * @brief Structure describing how quickly a network's discovery found its peers.
+ */
+typedef struct {
+	double time_to_first_peer;      ///< Seconds from initialization until the first peer was connected to (-1 if none has been yet).
+	double time_to_target_peers;    ///< Seconds from initialization until target_peers were connected at once (-1 if they haven't been yet).
+	int connected_peers;            ///< The number of discovered peers which are currently connected.
+	int target_peers;               ///< The number of peers discovery is aiming for.
+	int rounds;                     ///< The number of DHT (or simulated) search rounds so far.
+} P2PDiscoveryMetrics;
+
+/**
+ * @struct P2PTopicStats
+ * @brief Structure holding the traffic counters of a topic (or of a whole network).
+ */
+typedef struct {
+	unsigned long long messages_published;  ///< Messages successfully published.
+	unsigned long long bytes_published;     ///< Payload bytes successfully published.
+	unsigned long long publish_errors;      ///< Messages which failed to publish.
+	unsigned long long messages_received;   ///< Messages handed to the application (including our own).
+	unsigned long long bytes_received;      ///< Payload bytes handed to the application.
+	int buffered_messages;                  ///< Received messages waiting in subscription buffers to be handed to the application.
+	int peers;                              ///< Peers currently in the topic (for a network, peers sharing at least one topic with us).
+} P2PTopicStats;
+
+/**
+ * @struct P2PStats
+ * @brief Structure holding a network's runtime statistics, every counter covers the whole life of the network.
+ */
+typedef struct {
+	P2PTopicStats totals;                       ///< Traffic summed over every topic (including topics which have since been left).
+	int topics;                                 ///< The number of topics currently subscribed to.
+	int connected_peers;                        ///< Peers with an open connection (whether or not they share a topic with us).
+	unsigned long long callbacks;               ///< Calls made into the application's callbacks.
+	double callback_time;                       ///< Total seconds spent inside of those callbacks.
+	unsigned long long peer_connected_events;   ///< Peer connected events (whether delivered by callback or event queue).
+	unsigned long long peer_disconnected_events;///< Peer disconnected events.
+	unsigned long long dials;                   ///< Successful connections made by discovery or p2p_connect_peer().
+	unsigned long long failed_dials;            ///< Connection attempts which failed.
+	unsigned long long errors;                  ///< Errors reported to the error callback (or event queue).
+	int publish_queue_depth;                    ///< Messages waiting to be published by p2p_broadcast_message_async().
+	int queued_messages;                        ///< Messages waiting in the message queue to be polled (0 without a message queue).
+	unsigned long long dropped_messages;        ///< Messages the message queue has dropped because it was full.
+} P2PStats;
+
+/**
+ * @enum P2PCallbackKind
+ * @brief Enumeration of the kinds of callbacks the library calls into the application with.
+ */
+typedef enum {
+	P2P_CALLBACK_MESSAGE,   ///< The message and message batch callbacks (called once per batch).
+	P2P_CALLBACK_PUBLISH,   ///< Asynchronous publish completion callbacks.
+	P2P_CALLBACK_PEER,      ///< The peer connected and disconnected callbacks.
+	P2P_CALLBACK_TOPIC,     ///< The topic subscribed and unsubscribed callbacks.
+	P2P_CALLBACK_NETWORK,   ///< The connected and disconnected callbacks.
+	P2P_CALLBACK_ERROR,     ///< The error callback.
+	P2P_CALLBACK_KIND_COUNT ///< The number of kinds of callbacks.
+} P2PCallbackKind;
+
+/**
+ * @struct P2PCallbackProfile
+ * @brief Structure holding how long calls into the application's callbacks (from every network) have taken, indexed by P2PCallbackKind.
+ *
+ * total_time - callback_time is the time spent by the library crossing from Go into C and back.
+ */
+typedef struct {
+	unsigned long long calls[P2P_CALLBACK_KIND_COUNT]; ///< The number of calls made (calls where no callback is set aren't counted).
+	double total_time[P2P_CALLBACK_KIND_COUNT];        ///< Seconds spent in the calls as seen from Go.
+	double callback_time[P2P_CALLBACK_KIND_COUNT];     ///< Seconds spent inside the application's callbacks.
+} P2PCallbackProfile;
+
+/**
+ * @struct P2PLatencyStats
+ * @brief Structure summarizing the publish to delivery latencies (in seconds) recorded for a topic, see p2p_set_latency_tracking().
+ *
+ * Percentiles come from a histogram with ~3% precision, min, mean, and max are exact.
+ */
+typedef struct {
+	unsigned long long count;   ///< The number of latencies recorded (all other fields are 0 if this is).
+	double min;                 ///< The smallest latency.
+	double mean;                ///< The average latency.
+	double p50;                 ///< The median latency.
+	double p90;                 ///< The 90th percentile latency.
+	double p99;                 ///< The 99th percentile latency.
+	double p999;                ///< The 99.9th percentile latency.
+	double max;                 ///< The largest latency.
+} P2PLatencyStats;
+
+/**
+ * @struct P2PLinkOptions
+ * @brief Structure describing a link between two networks inside a simulation.
+ */
+typedef struct {
+	double latency;     ///< The time in seconds a message takes to cross the link.
+	double bandwidth;   ///< The bytes per second the link can carry (0 for unlimited).
+	double loss;        ///< The fraction (0-1) of published messages lost crossing the link (independently in each direction, a lost message may still arrive by another route).
+} P2PLinkOptions;
+
 /**
  * @brief Returns the default initialization arguments for P2P network.
  *
@@ -191,11 +445,215 @@ P2PNetwork p2p_initialize(P2PInitializationArguments args);
  * @brief Shuts down P2P network.
  *
  * This function shuts down P2P network by calling the corresponding Go function.
+ * Any message or event queues are freed once the network has disconnected (the disconnected callback is invoked even if events are queued).
+ * Every background task of the network is stopped first, so no callback or queue is touched once this returns.
+ * @warning Must not be called from inside one of the network's callbacks (it waits for them to finish)!
  *
  * @param network The network to manipulate.
  */
 void p2p_shutdown(P2PNetwork network);
 
+/**
+ * @brief Creates an in-process simulated network.
+ *
+ * Networks initialized with this simulation (see P2PInitializationArguments::simulation) run on libp2p's in-memory mocknet instead of real sockets, so hundreds of them can share one process.
+ * Every network in the simulation is linked to every other, with P2P_DISCOVERY_LOCAL treating the simulation as the local network (no mDNS or DHT traffic leaves the process).
+ * Identities (when none is provided), discovery, and message loss are derived from the seed so initializing the same networks in the same order reproduces the same simulation.
+ *
+ * @param defaults The options every link starts with.
+ * @param seed The seed for the simulation's random choices.
+ * @return The simulation.
+ */
+P2PSimulation p2p_create_simulation(P2PLinkOptions defaults, long long seed);
+
+/**
+ * @brief Changes the link between two networks inside the same simulation.
+ *
+ * @param simulation The simulation both networks are running inside.
+ * @param a The network on one end of the link.
+ * @param b The network on the other end of the link.
+ * @param options The link's new latency, bandwidth, and loss.
+ * @return True if the link was changed, false if either network is invalid or not part of the simulation.
+ */
+bool p2p_set_link_options(P2PSimulation simulation, P2PNetwork a, P2PNetwork b, P2PLinkOptions options);
+
+/**
+ * @brief Destroys a simulation.
+ *
+ * @note Every network running inside the simulation should be shutdown first!
+ * @param simulation The simulation to destroy.
+ */
+void p2p_destroy_simulation(P2PSimulation simulation);
+
+/**
+ * @brief Connects directly to a peer, bypassing discovery.
+ *
+ * This function dials the peer at the given multiaddr (which must include its /p2p/ peer ID) and blocks until the connection succeeds or the dial timeout (see p2p_configure_dialer()) elapses.
+ * If this is the first peer the network has connected to, the connected callback fires immediately instead of waiting for discovery.
+ *
+ * @param network The network to manipulate.
+ * @param multiaddr The peer's multiaddr (e.g. "/ip4/192.168.1.2/udp/4001/quic-v1/p2p/12D3KooW...").
+ * @return True if the connection succeeded, false otherwise.
+ */
+bool p2p_connect_peer(P2PNetwork network, const char* multiaddr);
+
+/**
+ * @brief Connects directly to a peer, bypassing discovery.
+ *
+ * This function dials the peer at the given multiaddr (which must include its /p2p/ peer ID) and blocks until the connection succeeds or the dial timeout (see p2p_configure_dialer()) elapses.
+ * If this is the first peer the network has connected to, the connected callback fires immediately instead of waiting for discovery.
+ *
+ * @param network The network to manipulate.
+ * @param multiaddr The peer's multiaddr.
+ * @param multiaddrSize The length of the multiaddr.
+ * @return True if the connection succeeded, false otherwise.
+ */
+bool p2p_connect_peern(P2PNetwork network, const char* multiaddr, int multiaddrSize);
+
+/**
+ * @brief Connects directly to several peers in parallel, bypassing discovery.
+ *
+ * This function dials the multiaddrs in parallel (up to the dial concurrency limit) and blocks until all of them have connected or failed.
+ * The connected callback fires as soon as the first connection succeeds (if the network wasn't already connected).
+ * Multiaddrs of a peer which is already being dialed (by this call or anything else) wait for that dial and share its result.
+ *
+ * @param network The network to manipulate.
+ * @param multiaddrs Array of peer multiaddrs.
+ * @param count The number of multiaddrs.
+ * @param results Optional (may be NULL) array of count bools recording whether each connection succeeded.
+ * @return The number of peers successfully connected to.
+ */
+int p2p_connect_peers(P2PNetwork network, const char* const* multiaddrs, int count, bool* results);
+
+/**
+ * @brief Configures how many peers the network dials at once, and how long each dial may take.
+ *
+ * Discovery can turn up hundreds of candidate peers at once, dialing them all together causes connection storms and file descriptor spikes.
+ * Instead at most maxConcurrentDials are in flight (candidates with the lowest previously measured round trip time are dialed first, and peers which are already connected are skipped).
+ * May be called before the network is initialized (see p2p_next_network()).
+ *
+ * @param network The network to manipulate.
+ * @param maxConcurrentDials The maximum number of dials in progress at once (the default is 8).
+ * @param dialTimeout The time in seconds a single dial may take before it is abandoned (the default is 15).
+ * @return True if the dialer was configured, false if the network is invalid or the arguments are out of range.
+ */
+bool p2p_configure_dialer(P2PNetwork network, int maxConcurrentDials, double dialTimeout);
+
+/**
+ * @brief Gets how quickly the network's discovery has found its peers.
+ *
+ * Discovery keeps running in the background after the first peer is found, until targetPeerCount peers are connected (and again whenever peers are lost).
+ *
+ * @param network The network to query.
+ * @param out Filled with the network's discovery metrics.
+ * @return True if the metrics were filled in, false if the network is invalid.
+ */
+bool p2p_discovery_metrics(P2PNetwork network, P2PDiscoveryMetrics* out);
+
+/**
+ * @brief Gets a network's runtime statistics.
+ *
+ * The counters are updated atomically on the hot paths (so they are always cheap to keep), but separate counters aren't read as one consistent snapshot.
+ *
+ * @param network The network to query.
+ * @param out Filled with the network's statistics.
+ * @return True if the statistics were filled in, false if the network is invalid.
+ */
+bool p2p_get_stats(P2PNetwork network, P2PStats* out);
+
+/**
+ * @brief Gets the traffic statistics of one of a network's topics.
+ *
+ * @param network The network to query.
+ * @param topic The topic to query.
+ * @param out Filled with the topic's statistics.
+ * @return True if the statistics were filled in, false if the network or topic is invalid.
+ */
+bool p2p_get_topic_stats(P2PNetwork network, P2PTopic topic, P2PTopicStats* out);
+
+/**
+ * @brief Enables or disables latency tracking.
+ *
+ * While enabled the network stamps a small header (12 bytes) holding the wall-clock publish time on every message it publishes, and records the latency of every stamped message it receives from others into a per topic histogram (see p2p_get_latency_stats()).
+ * The header is removed before messages are delivered, so the application's payloads are unchanged, but only while tracking is enabled (so payloads which happen to look stamped are left alone).
+ * Every network sharing a topic should therefore enable (or disable) tracking together, otherwise those which aren't tracking receive the header as part of the payload.
+ * Latencies between machines include the difference between their clocks.
+ *
+ * @note Can be called before the network is initialized (with the ID from p2p_next_network()).
+ * @param network The network to manipulate.
+ * @param enable Whether latency should be tracked.
+ */
+void p2p_set_latency_tracking(P2PNetwork network, bool enable);
+
+/**
+ * @brief Summarizes the publish to delivery latencies recorded for a topic.
+ *
+ * @param network The network to query.
+ * @param topic The topic to query.
+ * @param out Filled with the summary.
+ * @param reset Whether to clear the recorded latencies afterwards, so periodic dumps each only cover their own interval.
+ * @return True if the summary was filled in, false if the network or topic is invalid.
+ */
+bool p2p_get_latency_stats(P2PNetwork network, P2PTopic topic, P2PLatencyStats* out, bool reset);
+
+/**
+ * @brief Gets how long calls into the application's callbacks have taken, to tell the library's cost from the application's.
+ *
+ * The profile covers every network in the process.
+ *
+ * @param out Filled with the profile.
+ * @param reset Whether to clear the profile afterwards, so periodic dumps each only cover their own interval.
+ */
+void p2p_get_callback_profile(P2PCallbackProfile* out, bool reset);
+
+/**
+ * @brief Starts writing a CPU profile of the library's Go runtime to a file.
+ *
+ * The profile is in the standard pprof format (view it with `go tool pprof`), it keeps being written until p2p_stop_cpu_profile() is called.
+ *
+ * @param path The file to write the profile to.
+ * @return True if profiling started, false if the file couldn't be created or a profile is already running.
+ */
+bool p2p_start_cpu_profile(const char* path);
+
+/**
+ * @brief Stops the running CPU profile and finishes writing it.
+ *
+ * @return True if a profile was stopped and written, false otherwise.
+ */
+bool p2p_stop_cpu_profile();
+
+/**
+ * @brief Writes a heap profile of the library's Go runtime to a file.
+ *
+ * The profile is in the standard pprof format (view it with `go tool pprof`).
+ *
+ * @param path The file to write the profile to.
+ * @return True if the profile was written, false otherwise.
+ */
+bool p2p_write_heap_profile(const char* path);
+
+/**
+ * @brief Writes the stacks of every goroutine in the library's Go runtime to a file.
+ *
+ * The dump is in the standard pprof format (view it with `go tool pprof`, `-traces` lists every stack).
+ *
+ * @param path The file to write the dump to.
+ * @return True if the dump was written, false otherwise.
+ */
+bool p2p_write_goroutine_dump(const char* path);
+
+/**
+ * @brief Returns the multiaddrs the network is listening on (including our /p2p/ peer ID) so other nodes can connect to us directly.
+ *
+ * This function returns the network's listen addresses separated by newlines, each of which can be passed to p2p_connect_peer() on another node.
+ *
+ * @note This pointer is heap allocated and must be freed by the caller!
+ * @param network The network to query.
+ * @return The listen addresses (NULL if the network is invalid).
+ */
+char* p2p_listen_addresses(P2PNetwork network);
+
 /**
  * @brief Returns the local hashed ID for P2P network.
  *
@@ -207,6 +665,31 @@ void p2p_shutdown(P2PNetwork network);
  */
 char* p2p_local_id(P2PNetwork network);
 
+/**
+ * @brief Looks up the ID of a peer from its handle.
+ *
+ * Interned IDs are kept by the library, so this doesn't allocate.
+ *
+ * @param network The network the handle belongs to.
+ * @param peer The handle of the peer.
+ * @param size Set to the length of the ID (may be NULL, the ID is also null terminated but may contain embedded nulls).
+ * @note The returned pointer is owned by the library and stays valid until the network is shutdown.
+ * @return The ID of the peer, or NULL if the handle is invalid.
+ */
+const char* p2p_peer_id(P2PNetwork network, P2PPeer peer, int* size);
+
+/**
+ * @brief Gets the handle of a peer from its ID.
+ *
+ * Handles are only assigned to peers the network has heard from (through peer events or messages), and stay assigned until the network is shutdown.
+ *
+ * @param network The network to manipulate.
+ * @param id The ID of the peer.
+ * @param idSize The length of id.
+ * @return The handle of the peer, or -1 if the network is invalid or hasn't seen the peer.
+ */
+P2PPeer p2p_peer_handle(P2PNetwork network, const char* id, int idSize);
+
 /**
  * @brief Subscribes to a topic with the provided name.
  *
@@ -276,6 +759,33 @@ char* p2p_topic_name(P2PNetwork network, P2PTopic topicID);
  */
 bool p2p_leave_topic(P2PNetwork network, P2PTopic id);
 
+/**
+ * @brief Lists the peers currently in a topic, copying a snapshot of their IDs into caller provided buffers in a single call (without any allocations).
+ *
+ * Each peer ID is copied into buf followed by a null terminator, offsets[i] is where the i-th ID starts and offsets[count] is where the last one ends (so the size of the i-th ID is offsets[i + 1] - offsets[i] - 1).
+ * If the peers don't all fit nothing useful is written and minus the number of peers is returned, so the buffers can be grown before trying again.
+ *
+ * @param network The network to query.
+ * @param topic The topic whose peers should be listed.
+ * @param buf Buffer the peer IDs are copied into.
+ * @param bufSize The size of buf.
+ * @param offsets Array (with room for maxPeers + 1 entries) filled with where each peer ID starts in buf.
+ * @param maxPeers The maximum number of peers which can be listed.
+ * @return The number of peers in the topic (0 if the network or topic is invalid), negated if they didn't fit in the buffers.
+ */
+int p2p_list_peers(P2PNetwork network, P2PTopic topic, char* buf, int bufSize, int* offsets, int maxPeers);
+
+/**
+ * @brief Gets a counter which changes every time the peers in a topic change.
+ *
+ * Callers holding a snapshot from p2p_list_peers() can compare this against the version they took it at and skip listing the peers again if it hasn't changed.
+ *
+ * @param network The network to query.
+ * @param topic The topic to check.
+ * @return The version of the topic's peer list, or -1 if the network or topic is invalid.
+ */
+long long p2p_peer_list_version(P2PNetwork network, P2PTopic topic);
+
 /**
  * @brief Broadcasts a message to the specified P2P topic with the provided message.
  *
@@ -301,6 +811,155 @@ bool p2p_broadcast_message(P2PNetwork network, const char* message, P2PTopic top
  */
 bool p2p_broadcast_messagen(P2PNetwork network, const char* message, int messageSize, P2PTopic topicID);
 
+/**
+ * @brief Allocates a library owned buffer which can be filled and then broadcast without being copied.
+ *
+ * p2p_broadcast_messagen() has to copy the message, since the library keeps hold of published messages (to resend them to peers) after it returns.
+ * Messages written directly into a buffer from this function avoid that copy, which matters for large messages.
+ * The buffer must be passed to exactly one of p2p_broadcast_buffer() or p2p_release_buffer(), and must not be accessed afterwards.
+ *
+ * @param size The size of the buffer.
+ * @return Pointer to the buffer (NULL if size isn't positive).
+ */
+char* p2p_acquire_buffer(int size);
+
+/**
+ * @brief Returns a buffer allocated by p2p_acquire_buffer() without broadcasting it.
+ *
+ * @param buffer The buffer to release.
+ */
+void p2p_release_buffer(char* buffer);
+
+/**
+ * @brief Broadcasts the contents of a buffer allocated by p2p_acquire_buffer() to the specified P2P topic without copying it.
+ *
+ * The buffer is consumed (even if the broadcast fails) and must not be accessed after this function is called.
+ *
+ * @param network The network to manipulate.
+ * @param buffer The buffer to broadcast.
+ * @param messageSize The number of bytes of the buffer to broadcast.
+ * @param topicID The P2P topic ID to broadcast the message to.
+ * @return True if the message was successfully broadcasted, false otherwise.
+ */
+bool p2p_broadcast_buffer(P2PNetwork network, char* buffer, int messageSize, P2PTopic topicID);
+
+/**
+ * @brief Broadcasts a batch of messages, each to its own P2P topic.
+ *
+ * This function broadcasts every message in the batch with a single call to the corresponding Go function.
+ *
+ * @param network The network to manipulate.
+ * @param messages The messages (and the topics they should be broadcast to) to broadcast.
+ * @param count The number of messages.
+ * @param results Optional array of count bools, set to whether or not each message was successfully broadcasted (may be NULL).
+ * @return The number of messages which were successfully broadcasted.
+ */
+int p2p_broadcast_messages(P2PNetwork network, const P2POutMessage* messages, int count, bool* results);
+
+/**
+ * @brief Queues a message to be broadcast to the specified P2P topic without waiting for it to be published.
+ *
+ * The message is copied into a bounded per-network queue which is drained by a pool of worker threads, so slow peers or signing never stall the caller.
+ * When the queue fills to its high watermark messages are rejected (with P2P_PUBLISH_BACKPRESSURE) until it drains back to its low watermark.
+ *
+ * @param network The network to manipulate.
+ * @param message The message to broadcast.
+ * @param messageSize The size of the message.
+ * @param topicID The P2P topic ID to broadcast the message to.
+ * @param callback Optional function invoked (on a worker thread) once the message has been published (or failed to be).
+ * @param userData Pointer passed through to callback.
+ * @return P2P_PUBLISH_QUEUED if the message was queued (callback will be invoked), otherwise the reason it wasn't (callback won't be invoked).
+ */
+P2PPublishStatus p2p_broadcast_message_async(P2PNetwork network, const char* message, int messageSize, P2PTopic topicID, P2PPublishCallback callback, void* userData);
+
+/**
+ * @brief Configures the queue used by p2p_broadcast_message_async() for P2P network.
+ *
+ * By default the queue holds 1024 messages, is drained by 4 workers, and applies backpressure between 768 and 256 queued messages.
+ *
+ * @param network The network to manipulate.
+ * @param depth The maximum number of messages that can be waiting to be published.
+ * @param workers The number of worker threads publishing messages.
+ * @param highWatermark Once this many messages are waiting new messages are rejected with P2P_PUBLISH_BACKPRESSURE...
+ * @param lowWatermark ... until the queue drains back down to this many messages.
+ * @return False if messages have already been published asynchronously (the configuration can no longer be changed).
+ */
+bool p2p_configure_async_publish(P2PNetwork network, int depth, int workers, int highWatermark, int lowWatermark);
+
+/**
+ * @brief Returns the number of messages waiting to be published asynchronously by P2P network.
+ *
+ * @param network The network to query.
+ * @return The number of queued messages.
+ */
+int p2p_async_publish_queue_depth(P2PNetwork network);
+
+/**
+ * @brief Switches P2P network to queuing incoming messages for polling instead of invoking the message callbacks.
+ *
+ * Messages are pushed into a lock-free queue (owned by the library) as they arrive and can then be pulled out, on whichever thread the application prefers, with p2p_poll_messages().
+ *
+ * @param network The network to manipulate.
+ * @param capacity The number of messages the queue can hold (rounded up to a power of two).
+ * @param policy What to do when a message arrives and the queue is full.
+ * @return True if the queue was enabled, false if the network already has one (or has been shutdown).
+ */
+bool p2p_enable_message_queue(P2PNetwork network, int capacity, P2POverflowPolicy policy);
+
+/**
+ * @brief Removes up to max messages from the front of P2P network's message queue.
+ *
+ * @note The messages stay valid until the next call to this function (or the network is shutdown), this function must not be called from multiple threads at once!
+ * @param network The network to manipulate.
+ * @param out Array of at least max messages to fill.
+ * @param max The maximum number of messages to remove.
+ * @return The number of messages written to out, or -1 if the network has no message queue.
+ */
+int p2p_poll_messages(P2PNetwork network, P2PMessage* out, int max);
+
+/**
+ * @brief Returns the number of messages P2P network's message queue has dropped because it was full.
+ *
+ * @param network The network to query.
+ * @return The number of dropped messages (0 if the network has no message queue).
+ */
+unsigned long long p2p_message_queue_dropped(P2PNetwork network);
+
+/**
+ * @brief Switches P2P network to queuing peer, topic, and connection events for polling instead of invoking their callbacks.
+ *
+ * @note The queue is freed by p2p_shutdown, so the final P2P_EVENT_DISCONNECTED is still passed to the disconnected callback.
+ * @param network The network to manipulate.
+ * @param capacity The number of events the queue can hold (rounded up to a power of two).
+ * @param policy What to do when an event occurs and the queue is full.
+ * @return True if the queue was enabled, false if the network already has one (or has been shutdown).
+ */
+bool p2p_enable_event_queue(P2PNetwork network, int capacity, P2POverflowPolicy policy);
+
+/**
+ * @brief Removes up to max events from the front of P2P network's event queue.
+ *
+ * @note The events stay valid until the next call to this function (or the network is shutdown), this function must not be called from multiple threads at once!
+ * @param network The network to manipulate.
+ * @param out Array of at least max events to fill.
+ * @param max The maximum number of events to remove.
+ * @return The number of events written to out, or -1 if the network has no event queue.
+ */
+int p2p_poll_events(P2PNetwork network, P2PEvent* out, int max);
+
+/**
+ * @brief Returns a descriptor which becomes readable whenever P2P network has queued messages or events waiting to be polled.
+ *
+ * The descriptor is a Linux eventfd which can be added to an epoll set (or io_uring) so that the library fits into an existing event loop.
+ * Once it is readable, call p2p_poll_messages() and p2p_poll_events() until they return less than requested, polling resets the descriptor.
+ *
+ * @note Enables the event queue (holding 1024 events and dropping the oldest when full) if it hasn't already been enabled.
+ * @note The descriptor is owned by the library and closed when the network is shutdown.
+ * @param network The network to manipulate.
+ * @return The descriptor, or -1 if it couldn't be created (or the platform doesn't support eventfd).
+ */
+int p2p_event_fd(P2PNetwork network);
+
 
 
 // Callback Setters
@@ -315,8 +974,34 @@ bool p2p_broadcast_messagen(P2PNetwork network, const char* message, int message
  * @note the data passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
  * @param network The network to manipulate.
  * @param callback The message callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
+ */
+void p2p_set_message_callback(P2PNetwork network, P2PMsgCallback callback, void* userData);
+
+/**
+ * @brief Sets the message batch callback function for P2P network.
+ *
+ * This function sets the message batch callback function for P2P network. It bridges the provided callback function from C to Go.
+ * Messages which arrive together are delivered to this callback as a single array (limited by p2p_set_message_batch_limits()),
+ * afterwards the message callback (if any) is invoked for each message in the batch.
+ *
+ * @note the data passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
+ * @param network The network to manipulate.
+ * @param callback The message batch callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_message_callback(P2PNetwork network, P2PMsgCallback callback);
+void p2p_set_message_batch_callback(P2PNetwork network, P2PMsgBatchCallback callback, void* userData);
+
+/**
+ * @brief Sets how messages are grouped into batches for P2P network.
+ *
+ * By default up to 64 messages which have already arrived are grouped together, a batch is never delayed waiting for more messages.
+ *
+ * @param network The network to manipulate.
+ * @param maxCount The maximum number of messages delivered in a single batch.
+ * @param maxLatency The time (in seconds) to wait for more messages once the already buffered ones have been gathered (0 never waits).
+ */
+void p2p_set_message_batch_limits(P2PNetwork network, int maxCount, double maxLatency);
 
 /**
  * @brief Sets the peer connected callback function for P2P network.
@@ -326,8 +1011,9 @@ void p2p_set_message_callback(P2PNetwork network, P2PMsgCallback callback);
  * @note the data passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
  * @param network The network to manipulate.
  * @param callback The peer connected callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_peer_connected_callback(P2PNetwork network, P2PPeerCallback callback);
+void p2p_set_peer_connected_callback(P2PNetwork network, P2PPeerCallback callback, void* userData);
 
 /**
  * @brief Sets the peer disconnected callback function for P2P network.
@@ -337,8 +1023,9 @@ void p2p_set_peer_connected_callback(P2PNetwork network, P2PPeerCallback callbac
  * @note the data passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
  * @param network The network to manipulate.
  * @param callback The peer disconnected callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_peer_disconnected_callback(P2PNetwork network, P2PPeerCallback callback);
+void p2p_set_peer_disconnected_callback(P2PNetwork network, P2PPeerCallback callback, void* userData);
 
 /**
  * @brief Sets the topic subscribed callback function for P2P network.
@@ -347,8 +1034,9 @@ void p2p_set_peer_disconnected_callback(P2PNetwork network, P2PPeerCallback call
  *
  * @param network The network to manipulate.
  * @param callback The topic subscribed callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_topic_subscribed_callback(P2PNetwork network, P2PTopicCallback callback);
+void p2p_set_topic_subscribed_callback(P2PNetwork network, P2PTopicCallback callback, void* userData);
 
 /**
  * @brief Sets the topic unsubscribed callback function for P2P network.
@@ -357,8 +1045,9 @@ void p2p_set_topic_subscribed_callback(P2PNetwork network, P2PTopicCallback call
  *
  * @param network The network to manipulate.
  * @param callback The topic unsubscribed callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_topic_unsubscribed_callback(P2PNetwork network, P2PTopicCallback callback);
+void p2p_set_topic_unsubscribed_callback(P2PNetwork network, P2PTopicCallback callback, void* userData);
 
 /**
  * @brief Sets the connected callback function for P2P network.
@@ -367,8 +1056,9 @@ void p2p_set_topic_unsubscribed_callback(P2PNetwork network, P2PTopicCallback ca
  *
  * @param network The network to manipulate.
  * @param callback The connected callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
  */
-void p2p_set_connected_callback(P2PNetwork network, P2PVoidCallback callback);
+void p2p_set_connected_callback(P2PNetwork network, P2PVoidCallback callback, void* userData);
 
 /**
  * @brief Sets the disconnected callback function for P2P network.
@@ -377,8 +1067,46 @@ void p2p_set_connected_callback(P2PNetwork network, P2PVoidCallback callback);
  *
  * @param network The network to manipulate.
  * @param callback The disconnected callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
+ */
+void p2p_set_disconnected_callback(P2PNetwork network, P2PVoidCallback callback, void* userData);
+
+/**
+ * @brief Sets the error callback function for P2P network.
+ *
+ * This function sets the error callback function for P2P network. It bridges the provided callback function from C to Go.
+ * The callback is invoked (from a background thread) when something goes wrong which the network can recover from, such as discovery not finding any peers within the connection timeout.
+ *
+ * @note the description passed to the callback is freed as soon as this returns... if you need it to stick around longer you must copy it!
+ * @param network The network to manipulate.
+ * @param callback The error callback function to set.
+ * @param userData Pointer passed back to the callback every time it is invoked.
+ */
+void p2p_set_error_callback(P2PNetwork network, P2PErrorCallback callback, void* userData);
+
+/**
+ * @brief Sets the function the library's log messages (from every network) are delivered to.
+ *
+ * Messages are staged in a lock-free ring and delivered in batches from a background thread, identical messages
+ * repeated within a second are suppressed (the next record delivered for them reports how many were). If the callback
+ * can't keep up messages are dropped, a warning reporting how many is delivered once it catches up.
+ * Levels below the given one are never formatted, so turning logging off costs nothing.
+ * While no callback is set log messages are printed to stdout (everything if the network is verbose, otherwise only errors).
+ *
+ * @note the records passed to the callback are freed as soon as it returns... if you need them to stick around longer you must copy them!
+ * @param level The lowest level of message to deliver (P2P_LOG_OFF discards every message).
+ * @param callback The log callback function to set (NULL goes back to printing to stdout).
+ * @param userData Pointer passed back to the callback every time it is invoked.
+ */
+void p2p_set_log_callback(P2PLogLevel level, P2PLogCallback callback, void* userData);
+
+/**
+ * @brief Waits until every log message logged so far has been delivered to the log callback.
+ *
+ * Once it returns any log callback which has since been replaced is no longer in use, so its userData can be freed.
+ * @warning Must not be called from inside the log callback!
  */
-void p2p_set_disconnected_callback(P2PNetwork network, P2PVoidCallback callback);
+void p2p_flush_log();
 
 #ifdef __cplusplus
 } // extern "C"
@@ -8,7 +8,12 @@
 #include <iostream>
 #include <vector>
 #include <optional>
+#include <algorithm>
 #include <chrono>
+#include <future>
+#include <utility>
+#include <functional>
+#include <memory>
 
 
 namespace p2p {
@@ -45,6 +50,32 @@ namespace p2p {
 	 */
 	constexpr std::string_view default_discovery_topic = "simpleP2P";
 
+	/**
+	 * @brief Options controlling how a network finds its first peers.
+	 */
+	struct DiscoveryOptions {
+		std::vector<std::string> bootstrapPeers = {}; ///< Multiaddrs (including a /p2p/ peer ID) of peers to bootstrap from.
+		bool disablePublicBootstrap = false;          ///< Don't bootstrap from the public IPFS bootstrap peers.
+		P2PDiscoveryMode mode = P2P_DISCOVERY_DHT;    ///< How peers are discovered.
+		int targetPeers = 0;                          ///< Discovery keeps searching in the background until this many peers are connected (0 uses the library's default).
+		P2PSimulation simulation = 0;                 ///< Run inside this simulation (see Simulation) instead of on real sockets, 0 for none.
+
+		/**
+		 * @brief Options for only finding peers on the local network (using mDNS) or from a list of known peers, no internet access is needed.
+		 * @param bootstrapPeers Multiaddrs of peers to connect to directly.
+		 * @return The discovery options.
+		 */
+		static DiscoveryOptions local(std::vector<std::string> bootstrapPeers = {}) { return { std::move(bootstrapPeers), true, P2P_DISCOVERY_LOCAL }; }
+
+		/**
+		 * @brief Options for running inside a simulation, where the simulation's other networks are treated as the local network.
+		 * @param simulation The simulation to run inside.
+		 * @param targetPeers The number of other networks in the simulation to connect to (0 uses the library's default).
+		 * @return The discovery options.
+		 */
+		static DiscoveryOptions simulated(P2PSimulation simulation, int targetPeers = 0) { return { {}, true, P2P_DISCOVERY_LOCAL, targetPeers, simulation }; }
+	};
+
 	/**
 	 * @brief Returns the provided string encoded as a base64 string
 	 *
@@ -172,6 +203,80 @@ namespace p2p {
 		static Key generate() { return p2p_generate_key(); }
 	};
 
+	/**
+	 * @class Buffer
+	 * @brief Represents a library owned message buffer which can be broadcast without being copied.
+	 */
+	class Buffer {
+		char* buffer = nullptr;
+		size_t length = 0;
+		friend class Network;
+
+		/**
+		 * @brief Gives up ownership of the underlying buffer.
+		 * @return The underlying buffer.
+		 */
+		char* release() { length = 0; return std::exchange(buffer, nullptr); }
+	public:
+		/**
+		 * @brief Default constructor.
+		 */
+		Buffer() = default;
+
+		/**
+		 * @brief Constructor that allocates a buffer of the given size.
+		 * @param size The size of the buffer.
+		 */
+		Buffer(size_t size) : buffer(p2p_acquire_buffer(size)), length(buffer ? size : 0) {}
+
+		Buffer(const Buffer&) = delete;
+
+		/**
+		 * @brief Move constructor.
+		 * @param o The Buffer object to move from.
+		 */
+		Buffer(Buffer&& o) : length(o.length) { buffer = o.release(); }
+
+		/**
+		 * @brief Destructor, returns the buffer if it was never broadcast.
+		 */
+		~Buffer() { if(buffer) p2p_release_buffer(buffer); }
+
+		Buffer& operator=(const Buffer&) = delete;
+
+		/**
+		 * @brief Move assignment operator.
+		 * @param o The Buffer object to move from.
+		 * @return Reference to the assigned Buffer object.
+		 */
+		Buffer& operator=(Buffer&& o) {
+			if(buffer) p2p_release_buffer(buffer);
+			length = o.length;
+			buffer = o.release();
+			return *this;
+		}
+
+		/**
+		 * @brief Checks if the Buffer object holds a buffer.
+		 * @return True if the buffer is valid, false otherwise.
+		 */
+		bool valid() const { return buffer; }
+		operator bool() const { return valid(); }
+
+		/**
+		 * @brief Gets the size of the buffer.
+		 * @return The size of the buffer.
+		 */
+		size_t size() const { return length; }
+
+		/**
+		 * @brief Gets the contents of the buffer.
+		 * @return Writable view of the buffer.
+		 */
+		std::span<std::byte> data() { return {(std::byte*)buffer, length}; }
+		std::span<const std::byte> data() const { return {(const std::byte*)buffer, length}; }
+	};
+
 	/**
 	 * @struct Topic
 	 * @brief Represents a P2P topic.
@@ -210,8 +315,6 @@ namespace p2p {
 	 * @brief Represents the P2P network.
 	 */
 	class Network {
-		static std::map<P2PNetwork, Network*> networks;
-		friend class Message;
 	public:
 		/**
 		 * @brief the id of the underlying network the methods on this object manipulate
@@ -225,12 +328,14 @@ namespace p2p {
 
 		// Multicast delegates representing the different network events
 		delegate<void(Network&, struct Message&)> on_message;
-		delegate<void(Network&, PeerID::view)> on_peer_connected; // Note: only called for directly connected peers... if you need all peers work at a higher level!
-		delegate<void(Network&, PeerID::view)> on_peer_disconnected;
+		delegate<void(Network&, std::span<struct Message>)> on_message_batch; // Note: called with every group of messages which arrived together, before on_message is called for each of them
+		delegate<void(Network&, PeerID::view, P2PPeer)> on_peer_connected; // Note: only called for directly connected peers... if you need all peers work at a higher level!
+		delegate<void(Network&, PeerID::view, P2PPeer)> on_peer_disconnected;
 		delegate<void(Network&, Topic)> on_topic_subscribed;
 		delegate<void(Network&, Topic)> on_topic_unsubscribed;
 		delegate<void(Network&)> on_connected;
 		delegate<void(Network&)> on_disconnected;
+		delegate<void(Network&, P2PError, std::string_view)> on_error; // Note: called from a background thread, e.g. when no peers are found within the connection timeout (discovery keeps going)
 
 		/**
 		 * @brief Constructor that initializes the P2P network connection.
@@ -238,9 +343,10 @@ namespace p2p {
 		 * @param discoveryTopic The discovery topic for network initialization.
 		 * @param identityKey The identity key for network initialization.
 		 * @param do_on_connected Callback function to register in on_connected before initializing the connection
-		 * @param connectionTimeout The time to wait for a connection before giving up.
+		 * @param connectionTimeout The time to wait for the first peer before on_error is fired (discovery keeps searching).
 		 * @param fullyConnected Weather or not every message should be sent to every peer, or if the network should be more intelligent.
 		 * @param verbose Flag indicating if the GO library should spew some more verbose messages.
+		 * @param discovery How the network should find its first peers.
 		 */
 		Network(
 			std::string_view listenAddress = default_listen_address,
@@ -249,12 +355,13 @@ namespace p2p {
 			delegate_function<void(Network&)> do_on_connected = nullptr,
 			std::chrono::milliseconds connectionTimeout = std::chrono::seconds(60),
 			bool fullyConnected = false,
-			bool verbose = false
+			bool verbose = false,
+			const DiscoveryOptions& discovery = {}
 		) {
 			if(do_on_connected != nullptr)
 				on_connected = do_on_connected;
 
-			initialize(listenAddress, discoveryTopic, identityKey, connectionTimeout, fullyConnected, verbose);
+			initialize(listenAddress, discoveryTopic, identityKey, connectionTimeout, fullyConnected, verbose, discovery);
 		}
 
 		/**
@@ -266,7 +373,7 @@ namespace p2p {
 		/**
 		 * @brief Destructor.
 		 */
-		~Network() { shutdown(); networks.erase(network); }
+		~Network() { shutdown(); }
 
 		/**
 		 * @brief Copy constructor (deleted).
@@ -291,9 +398,10 @@ namespace p2p {
 		 * @param listenAddress The multiaddress we should listen for connections on.
 		 * @param discoveryTopic The discovery topic for network initialization.
 		 * @param identityKey The identity key for network initialization.
-		 * @param connectionTimeout The time to wait for a connection before giving up.
+		 * @param connectionTimeout The time to wait for the first peer before on_error is fired (discovery keeps searching).
 		 * @param fullyConnected Weather or not every message should be sent to every peer, or if the network should be more intelligent.
 		 * @param verbose Flag indicating if the GO library should spew some more verbose messages.
+		 * @param discovery How the network should find its first peers.
 		 */
 		void initialize(
 			std::string_view listenAddress = default_listen_address,
@@ -301,12 +409,14 @@ namespace p2p {
 			const Key& identityKey = {},
 			std::chrono::milliseconds connectionTimeout = std::chrono::seconds(60),
 			bool fullyConnected = false,
-			bool verbose = false
+			bool verbose = false,
+			const DiscoveryOptions& discovery = {}
 		) {
-			// Connect the connect delegate to its callback
-			override_connected_callback(on_connected_impl);
+			std::vector<const char*> bootstrapPeers;
+			for(auto& peer: discovery.bootstrapPeers)
+				bootstrapPeers.push_back(peer.c_str());
 
-			// Initialize the GO library!
+			// Initialize the GO library! (the connect and error delegates are connected to their callbacks before discovery can fire them)
 			network = p2p_initialize({
 				.listenAddress = listenAddress.data(),
 				.listenAddressSize = (long long)listenAddress.size(),
@@ -315,11 +425,20 @@ namespace p2p {
 				.identity = identityKey,
 				.connectionTimeout = std::chrono::duration_cast<std::chrono::duration<double>>(connectionTimeout).count(),
 				.fullyConnected = fullyConnected,
-				.verbose = verbose
+				.verbose = verbose,
+				.bootstrapPeers = bootstrapPeers.data(),
+				.bootstrapPeersCount = (int)bootstrapPeers.size(),
+				.disablePublicBootstrap = discovery.disablePublicBootstrap,
+				.discoveryMode = discovery.mode,
+				.targetPeerCount = discovery.targetPeers,
+				.simulation = discovery.simulation,
+				.connectedCallback = on_connected_impl,
+				.errorCallback = on_error_impl,
+				.callbackUserData = this
 			});
 
 			// Connect the delegates to the callbacks
-			override_message_callback(on_mesage_impl);
+			override_message_batch_callback(on_message_batch_impl);
 			override_disconnected_callback(on_disconnected_impl);
 			override_peer_connected_callback(on_peer_connected_impl);
 			override_peer_disconnected_callback(on_peer_disconnected_impl);
@@ -328,22 +447,234 @@ namespace p2p {
 
 			defaultTopic = { network, p2p_default_topic(network) };
 
-			networks[network] = this;
+			// Cache our ID so that it doesn't have to be fetched from the library every time it is needed
+			if(auto raw = p2p_local_id(network)) {
+				localID = raw;
+				free(raw);
+			}
+		}
+
+		/**
+		 * @brief Sets how incoming messages are grouped together before being passed to on_message_batch.
+		 * @param maxCount The maximum number of messages delivered in a single batch.
+		 * @param maxLatency How long to wait for more messages once the already buffered ones have been gathered (0 never waits).
+		 */
+		void set_message_batch_limits(int maxCount, std::chrono::microseconds maxLatency = {}) {
+			p2p_set_message_batch_limits(network, maxCount, std::chrono::duration_cast<std::chrono::duration<double>>(maxLatency).count());
+		}
+
+		/**
+		 * @brief Switches the network to queuing incoming messages for poll() instead of firing on_message/on_message_batch.
+		 * @param capacity The number of messages the queue can hold (rounded up to a power of two).
+		 * @param policy What to do when a message arrives and the queue is full.
+		 * @return True if the queue was enabled, false if the network already has one (or has been shutdown).
+		 */
+		bool enable_message_queue(int capacity = 1024, P2POverflowPolicy policy = P2P_OVERFLOW_DROP_OLDEST) { return p2p_enable_message_queue(network, capacity, policy); }
+
+		/**
+		 * @brief Removes up to max messages from the message queue.
+		 * @note The returned messages stay valid until the next call to poll, poll must not be called from multiple threads at once!
+		 * @param max The maximum number of messages to remove.
+		 * @return A view of the removed messages (empty if there were none or the message queue isn't enabled).
+		 */
+		std::span<struct Message> poll(size_t max = 64); // Defined below Message
+
+		/**
+		 * @brief Gets the number of messages the message queue has dropped because it was full.
+		 * @return The number of dropped messages.
+		 */
+		unsigned long long dropped_messages() const { return p2p_message_queue_dropped(network); }
+
+		/**
+		 * @brief Switches the network to queuing peer, topic, and connection events for poll_events() instead of firing their delegates.
+		 * @param capacity The number of events the queue can hold (rounded up to a power of two).
+		 * @param policy What to do when an event occurs and the queue is full.
+		 * @return True if the queue was enabled, false if the network already has one (or has been shutdown).
+		 */
+		bool enable_event_queue(int capacity = 1024, P2POverflowPolicy policy = P2P_OVERFLOW_DROP_OLDEST) { return p2p_enable_event_queue(network, capacity, policy); }
+
+		/**
+		 * @brief Removes up to max events from the event queue.
+		 * @note The returned events stay valid until the next call to poll_events, poll_events must not be called from multiple threads at once!
+		 * @param max The maximum number of events to remove.
+		 * @return A view of the removed events (empty if there were none or the event queue isn't enabled).
+		 */
+		std::span<P2PEvent> poll_events(size_t max = 64) {
+			polledEvents.resize(max);
+			int count = p2p_poll_events(network, polledEvents.data(), max);
+			if(count <= 0) return {};
+			return {polledEvents.data(), (size_t)count};
+		}
+
+		/**
+		 * @brief Removes up to max events from the event queue and fires the matching delegates on the calling thread.
+		 * @return The number of events dispatched.
+		 */
+		size_t dispatch_events(size_t max = 64) {
+			auto events = poll_events(max);
+			for(auto& event: events)
+				switch(event.type) {
+				case P2P_EVENT_PEER_CONNECTED:
+					if(!on_peer_connected.empty()) on_peer_connected(*this, {event.peer, (size_t)event.peer_size}, event.peer_handle);
+					break;
+				case P2P_EVENT_PEER_DISCONNECTED:
+					if(!on_peer_disconnected.empty()) on_peer_disconnected(*this, {event.peer, (size_t)event.peer_size}, event.peer_handle);
+					break;
+				case P2P_EVENT_TOPIC_SUBSCRIBED:
+					if(!on_topic_subscribed.empty()) on_topic_subscribed(*this, {network, event.topic});
+					break;
+				case P2P_EVENT_TOPIC_UNSUBSCRIBED:
+					if(!on_topic_unsubscribed.empty()) on_topic_unsubscribed(*this, {network, event.topic});
+					break;
+				case P2P_EVENT_CONNECTED:
+					if(!on_connected.empty()) on_connected(*this);
+					break;
+				case P2P_EVENT_DISCONNECTED:
+					if(!on_disconnected.empty()) on_disconnected(*this);
+					break;
+				case P2P_EVENT_ERROR:
+					if(!on_error.empty()) on_error(*this, event.error, {event.peer, (size_t)event.peer_size});
+					break;
+				}
+			return events.size();
 		}
 
+		/**
+		 * @brief Gets a descriptor (Linux eventfd) which becomes readable whenever messages or events are waiting to be polled.
+		 * @note Enables the event queue if it hasn't already been enabled, the descriptor is closed when the network is shutdown.
+		 * @return The descriptor, or -1 if it isn't supported.
+		 */
+		int event_fd() { return p2p_event_fd(network); }
+
 		/**
 		 * @brief Shuts down the network connection.
 		 */
 		void shutdown() { p2p_shutdown(network); }
 
+		/**
+		 * @brief Connects directly to a peer (bypassing discovery), blocking until it connects or the dial timeout elapses.
+		 * @note If this is the first peer connected to, on_connected fires immediately instead of waiting for discovery.
+		 * @param multiaddr The peer's multiaddr, which must include its /p2p/ peer ID.
+		 * @return True if the connection succeeded, false otherwise.
+		 */
+		bool connect(std::string_view multiaddr) { return p2p_connect_peern(network, multiaddr.data(), multiaddr.size()); }
+
+		/**
+		 * @brief Connects directly to several peers in parallel (bypassing discovery, up to the dial concurrency limit), blocking until every dial has finished.
+		 * @note on_connected fires as soon as the first connection succeeds (if the network wasn't already connected).
+		 * @param multiaddrs The peers' multiaddrs, each of which must include its /p2p/ peer ID.
+		 * @param results Optional span (at least as long as multiaddrs) which is filled with whether or not each connection succeeded.
+		 * @return The number of peers successfully connected to.
+		 */
+		int connect(std::span<const std::string_view> multiaddrs, std::span<bool> results = {}) {
+			std::vector<std::string> owned(multiaddrs.begin(), multiaddrs.end()); // The C API needs null terminated strings
+			std::vector<const char*> addresses; addresses.reserve(owned.size());
+			for(auto& address: owned)
+				addresses.push_back(address.c_str());
+			return p2p_connect_peers(network, addresses.data(), addresses.size(), results.empty() ? nullptr : results.data());
+		}
+
 		/**
 		 * @brief Gets the local hashed ID for the P2P network.
 		 * @return The local hashed ID.
 		 */
-		PeerID local_id() const {
-			auto raw = p2p_local_id(network);
-			std::string out = raw;
-			free((char*)raw);
+		const PeerID& local_id() const { return localID; }
+
+		/**
+		 * @brief Gets the multiaddrs (including our peer ID) other nodes can pass to connect() to reach this network directly.
+		 * @return The listen addresses.
+		 */
+		std::vector<std::string> listen_addresses() const {
+			std::vector<std::string> out;
+			auto raw = p2p_listen_addresses(network);
+			if(raw == nullptr) return out;
+
+			std::string_view all = raw;
+			while(!all.empty()) {
+				auto end = all.find('\n');
+				out.emplace_back(all.substr(0, end));
+				all = end == std::string_view::npos ? std::string_view{} : all.substr(end + 1);
+			}
+			free(raw);
+			return out;
+		}
+
+		/**
+		 * @brief Looks up the ID of a peer from its handle.
+		 * @note The view points into library owned memory which stays valid until the network is shutdown.
+		 * @param handle The handle of the peer.
+		 * @return The ID of the peer (empty if the handle is invalid).
+		 */
+		PeerID::view peer_id(P2PPeer handle) const {
+			int size = 0;
+			auto id = p2p_peer_id(network, handle, &size);
+			if(id == nullptr) return {};
+			return {id, (size_t)size};
+		}
+
+		/**
+		 * @brief Gets the handle of a peer from its ID.
+		 * @param id The ID of the peer.
+		 * @return The handle of the peer, or -1 if the network is invalid or hasn't seen the peer.
+		 */
+		P2PPeer peer_handle(PeerID::view id) const { return p2p_peer_handle(network, id.data(), id.size()); }
+
+		/**
+		 * @brief Configures how many peers are dialed at once (lowest previously measured round trip time first), and how long each dial may take.
+		 * @param maxConcurrentDials The maximum number of dials in progress at once.
+		 * @param dialTimeout How long a single dial may take before it is abandoned.
+		 * @return True if the dialer was configured, false if the network is invalid or the arguments are out of range.
+		 */
+		bool configure_dialer(int maxConcurrentDials, std::chrono::milliseconds dialTimeout = std::chrono::seconds(15)) {
+			return p2p_configure_dialer(network, maxConcurrentDials, std::chrono::duration_cast<std::chrono::duration<double>>(dialTimeout).count());
+		}
+
+		/**
+		 * @brief Gets how quickly discovery has found the network's peers.
+		 * @return The discovery metrics (zeroed if the network is invalid).
+		 */
+		P2PDiscoveryMetrics discovery_metrics() const {
+			P2PDiscoveryMetrics out = {};
+			p2p_discovery_metrics(network, &out);
+			return out;
+		}
+
+		/**
+		 * @brief Gets the network's runtime statistics (message rates, callback time, peers, etc...).
+		 * @return The statistics (zeroed if the network is invalid).
+		 */
+		P2PStats stats() const {
+			P2PStats out = {};
+			p2p_get_stats(network, &out);
+			return out;
+		}
+
+		/**
+		 * @brief Gets the traffic statistics of one of the network's topics.
+		 * @param topic The topic to query.
+		 * @return The statistics (zeroed if the topic is invalid).
+		 */
+		P2PTopicStats stats(Topic topic) const {
+			P2PTopicStats out = {};
+			p2p_get_topic_stats(network, topic.id, &out);
+			return out;
+		}
+
+		/**
+		 * @brief Enables or disables stamping published messages with their publish time and recording the latency of received ones (payloads are unchanged as long as every network sharing the topic tracks latency).
+		 * @param enable Whether latency should be tracked.
+		 */
+		void set_latency_tracking(bool enable = true) { p2p_set_latency_tracking(network, enable); }
+
+		/**
+		 * @brief Summarizes the publish to delivery latencies recorded for a topic.
+		 * @param topic The topic to query.
+		 * @param reset Whether to clear the recorded latencies afterwards (for periodic dumps).
+		 * @return The summary (zeroed if the topic is invalid or nothing has been recorded).
+		 */
+		P2PLatencyStats latency_stats(Topic topic, bool reset = false) const {
+			P2PLatencyStats out = {};
+			p2p_get_latency_stats(network, topic.id, &out, reset);
 			return out;
 		}
 
@@ -361,6 +692,46 @@ namespace p2p {
 		 */
 		Topic find_topic(std::string_view name) { return { network, p2p_find_topicn(network, name.data(), name.size()) }; }
 
+		/**
+		 * @brief Lists the peers currently in a topic.
+		 * @note The views point into storage reused by every call to peers, so they stay valid until the next call (which doesn't copy anything if the peers in the topic haven't changed).
+		 * @param topic The Topic object representing the topic whose peers should be listed.
+		 * @return Views of the IDs of the peers in the topic.
+		 */
+		std::span<const PeerID::view> peers(Topic topic) {
+			auto version = p2p_peer_list_version(network, topic.id);
+			if(topic.id == peerList.topic && version == peerList.version)
+				return peerList.views;
+
+			int count;
+			while((count = p2p_list_peers(network, topic.id, peerList.buffer.data(), peerList.buffer.size(), peerList.offsets.data(), peerList.offsets.size() - 1)) < 0) {
+				// Leave some room for more peers to join before we try again
+				peerList.offsets.resize(-count * 2 + 1);
+				peerList.buffer.resize(std::max(peerList.buffer.size() * 2, (size_t)-count * 2 * 64));
+			}
+
+			peerList.views.clear();
+			for(int i = 0; i < count; i++)
+				peerList.views.emplace_back(peerList.buffer.data() + peerList.offsets[i], peerList.offsets[i + 1] - peerList.offsets[i] - 1);
+			peerList.topic = topic.id;
+			peerList.version = version;
+			return peerList.views;
+		}
+
+		/**
+		 * @brief Lists the peers currently in the default topic.
+		 * @note The views point into storage reused by every call to peers, so they stay valid until the next call.
+		 * @return Views of the IDs of the peers in the default topic.
+		 */
+		std::span<const PeerID::view> peers() { return peers(defaultTopic); }
+
+		/**
+		 * @brief Gets a counter which changes every time the peers in a topic change.
+		 * @param topic The Topic object representing the topic to check.
+		 * @return The version of the topic's peer list, or -1 if the topic is invalid.
+		 */
+		long long peers_version(Topic topic) const { return p2p_peer_list_version(network, topic.id); }
+
 		/**
 		 * @brief Broadcasts a message to a topic.
 		 * @param message The message to broadcast.
@@ -378,116 +749,419 @@ namespace p2p {
 
 		/**
 		 * @brief Broadcasts a byte-span message to a topic.
+		 * @note The message is sent as is (no encoding required), so it may contain embedded nulls.
 		 * @param message The byte-span message to broadcast.
 		 * @param topic The Topic object representing the target topic.
 		 * @return True if the message was successfully broadcasted, false otherwise.
 		 */
-		bool broadcast_message(std::span<std::byte> message, Topic topic) const { return p2p_broadcast_messagen(network, (char*)message.data(), message.size(), topic.id); }
+		bool broadcast_message(std::span<const std::byte> message, Topic topic) const { return p2p_broadcast_messagen(network, (const char*)message.data(), message.size(), topic.id); }
 
 		/**
 		 * @brief Broadcasts a byte-span message to the default topic.
 		 * @param message The byte-span message to broadcast.
 		 * @return True if the message was successfully broadcasted, false otherwise.
 		 */
-		bool broadcast_message(std::span<std::byte> message) const { return broadcast_message(message, defaultTopic); }
+		bool broadcast_message(std::span<const std::byte> message) const { return broadcast_message(message, defaultTopic); }
+
+		/**
+		 * @brief Broadcasts the contents of a buffer to a topic without copying it.
+		 * @note The buffer is consumed (even if the broadcast fails).
+		 * @param buffer The Buffer to broadcast.
+		 * @param topic The Topic object representing the target topic.
+		 * @param size The number of bytes of the buffer to broadcast (defaults to the whole buffer).
+		 * @return True if the message was successfully broadcasted, false otherwise.
+		 */
+		bool broadcast_buffer(Buffer&& buffer, Topic topic, std::optional<size_t> size = {}) const {
+			auto length = size.value_or(buffer.size());
+			return p2p_broadcast_buffer(network, buffer.release(), length, topic.id);
+		}
+
+		/**
+		 * @brief Broadcasts the contents of a buffer to the default topic without copying it.
+		 * @note The buffer is consumed (even if the broadcast fails).
+		 * @param buffer The Buffer to broadcast.
+		 * @param size The number of bytes of the buffer to broadcast (defaults to the whole buffer).
+		 * @return True if the message was successfully broadcasted, false otherwise.
+		 */
+		bool broadcast_buffer(Buffer&& buffer, std::optional<size_t> size = {}) const { return broadcast_buffer(std::move(buffer), defaultTopic, size); }
+
+		/**
+		 * @brief Broadcasts a batch of messages, each to its own topic, in a single call into the library.
+		 * @param messages The messages (and the topics they should be broadcast to) to broadcast.
+		 * @param results Optional span (at least as long as messages) which is filled with whether or not each message was successfully broadcasted.
+		 * @return The number of messages which were successfully broadcasted.
+		 */
+		int broadcast_messages(std::span<const P2POutMessage> messages, std::span<bool> results = {}) const {
+			return p2p_broadcast_messages(network, messages.data(), messages.size(), results.empty() ? nullptr : results.data());
+		}
+
+		/**
+		 * @brief Broadcasts a batch of messages to a topic in a single call into the library.
+		 * @param messages The messages to broadcast.
+		 * @param topic The Topic object representing the target topic.
+		 * @param results Optional span (at least as long as messages) which is filled with whether or not each message was successfully broadcasted.
+		 * @return The number of messages which were successfully broadcasted.
+		 */
+		int broadcast_messages(std::span<const std::string_view> messages, Topic topic, std::span<bool> results = {}) const {
+			std::vector<P2POutMessage> batch; batch.reserve(messages.size());
+			for(auto message: messages)
+				batch.push_back({message.data(), (int)message.size(), topic.id});
+			return broadcast_messages(batch, results);
+		}
+
+		/**
+		 * @brief Broadcasts a batch of messages to the default topic in a single call into the library.
+		 * @param messages The messages to broadcast.
+		 * @param results Optional span (at least as long as messages) which is filled with whether or not each message was successfully broadcasted.
+		 * @return The number of messages which were successfully broadcasted.
+		 */
+		int broadcast_messages(std::span<const std::string_view> messages, std::span<bool> results = {}) const { return broadcast_messages(messages, defaultTopic, results); }
+
+		/**
+		 * @brief Queues a byte-span message to be broadcast to a topic without waiting for it to be published.
+		 * @param message The byte-span message to broadcast (copied before this function returns).
+		 * @param topic The Topic object representing the target topic.
+		 * @param status Optional pointer filled with whether the message was queued, or why it wasn't.
+		 * @return A future which becomes true once the message has been published, or false if publishing it failed (or it wasn't queued).
+		 */
+		std::future<bool> broadcast_message_async(std::span<const std::byte> message, Topic topic, P2PPublishStatus* status = nullptr) const {
+			auto promise = new std::promise<bool>();
+			auto future = promise->get_future();
+			auto result = p2p_broadcast_message_async(network, (const char*)message.data(), message.size(), topic.id, [](P2PNetwork, bool success, void* userData) {
+				auto promise = (std::promise<bool>*)userData;
+				promise->set_value(success);
+				delete promise;
+				return true;
+			}, promise);
+			if(status) *status = result;
+			if(result != P2P_PUBLISH_QUEUED) {
+				promise->set_value(false);
+				delete promise;
+			}
+			return future;
+		}
+
+		/**
+		 * @brief Queues a byte-span message to be broadcast to the default topic without waiting for it to be published.
+		 * @param message The byte-span message to broadcast (copied before this function returns).
+		 * @param status Optional pointer filled with whether the message was queued, or why it wasn't.
+		 * @return A future which becomes true once the message has been published, or false if publishing it failed (or it wasn't queued).
+		 */
+		std::future<bool> broadcast_message_async(std::span<const std::byte> message, P2PPublishStatus* status = nullptr) const { return broadcast_message_async(message, defaultTopic, status); }
+
+		/**
+		 * @brief Queues a message to be broadcast to a topic without waiting for it to be published.
+		 * @param message The message to broadcast (copied before this function returns).
+		 * @param topic The Topic object representing the target topic.
+		 * @param status Optional pointer filled with whether the message was queued, or why it wasn't.
+		 * @return A future which becomes true once the message has been published, or false if publishing it failed (or it wasn't queued).
+		 */
+		std::future<bool> broadcast_message_async(std::string_view message, Topic topic, P2PPublishStatus* status = nullptr) const { return broadcast_message_async(std::as_bytes(std::span{message}), topic, status); }
+
+		/**
+		 * @brief Queues a message to be broadcast to the default topic without waiting for it to be published.
+		 * @param message The message to broadcast (copied before this function returns).
+		 * @param status Optional pointer filled with whether the message was queued, or why it wasn't.
+		 * @return A future which becomes true once the message has been published, or false if publishing it failed (or it wasn't queued).
+		 */
+		std::future<bool> broadcast_message_async(std::string_view message, P2PPublishStatus* status = nullptr) const { return broadcast_message_async(message, defaultTopic, status); }
+
+		/**
+		 * @brief Configures the queue used by broadcast_message_async.
+		 * @param depth The maximum number of messages that can be waiting to be published.
+		 * @param workers The number of worker threads publishing messages.
+		 * @param highWatermark Once this many messages are waiting new messages are rejected with P2P_PUBLISH_BACKPRESSURE...
+		 * @param lowWatermark ... until the queue drains back down to this many messages.
+		 * @return False if messages have already been published asynchronously (the configuration can no longer be changed).
+		 */
+		bool configure_async_publish(int depth, int workers, int highWatermark, int lowWatermark) { return p2p_configure_async_publish(network, depth, workers, highWatermark, lowWatermark); }
+
+		/**
+		 * @brief Gets the number of messages waiting to be published asynchronously.
+		 * @return The number of queued messages.
+		 */
+		int async_publish_queue_depth() const { return p2p_async_publish_queue_depth(network); }
 
 	protected:
 		/**
 		 * @brief Overrides the message callback with the provided function pointer.
 		 * @param callback The function pointer to the message callback.
+		 * @note The callback is passed this Network as its userData.
 		 */
-		void override_message_callback(P2PMsgCallback callback) { p2p_set_message_callback(network, callback); }
+		void override_message_callback(P2PMsgCallback callback) { p2p_set_message_callback(network, callback, this); }
+
+		/**
+		 * @brief Overrides the message batch callback with the provided function pointer.
+		 * @param callback The function pointer to the message batch callback.
+		 * @note The callback is passed this Network as its userData.
+		 */
+		void override_message_batch_callback(P2PMsgBatchCallback callback) { p2p_set_message_batch_callback(network, callback, this); }
 
 		/**
 		 * @brief Overrides the peer connected callback with the provided function pointer.
 		 * @param callback The function pointer to the peer connected callback.
+		 * @note The callback is passed this Network as its userData.
 		 */
-		void override_peer_connected_callback(P2PPeerCallback callback) { p2p_set_peer_connected_callback(network, callback); }
+		void override_peer_connected_callback(P2PPeerCallback callback) { p2p_set_peer_connected_callback(network, callback, this); }
 
 		/**
 		 * @brief Overrides the peer disconnected callback with the provided function pointer.
 		 * @param callback The function pointer to the peer disconnected callback.
+		 * @note The callback is passed this Network as its userData.
 		 */
-		void override_peer_disconnected_callback(P2PPeerCallback callback) { p2p_set_peer_disconnected_callback(network, callback); }
+		void override_peer_disconnected_callback(P2PPeerCallback callback) { p2p_set_peer_disconnected_callback(network, callback, this); }
 
 		/**
 		 * @brief Overrides the topic subscribed callback with the provided function pointer.
 		 * @param callback The function pointer to the topic subscribed callback.
+		 * @note The callback is passed this Network as its userData.
 		 */
-		void override_topic_subscribed_callback(P2PTopicCallback callback) { p2p_set_topic_subscribed_callback(network, callback); }
+		void override_topic_subscribed_callback(P2PTopicCallback callback) { p2p_set_topic_subscribed_callback(network, callback, this); }
 
 		/**
 		 * @brief Overrides the topic unsubscribed callback with the provided function pointer.
 		 * @param callback The function pointer to the topic unsubscribed callback.
+		 * @note The callback is passed this Network as its userData.
 		 */
-		void override_topic_unsubscribed_callback(P2PTopicCallback callback) { p2p_set_topic_unsubscribed_callback(network, callback); }
+		void override_topic_unsubscribed_callback(P2PTopicCallback callback) { p2p_set_topic_unsubscribed_callback(network, callback, this); }
 
 		/**
 		 * @brief Overrides the connected callback with the provided function pointer.
 		 * @param callback The function pointer to the connected callback.
+		 * @note The callback is passed this Network as its userData.
 		 */
-		void override_connected_callback(P2PVoidCallback callback) { p2p_set_connected_callback(network, callback); }
+		void override_connected_callback(P2PVoidCallback callback) { p2p_set_connected_callback(network, callback, this); }
 
 		/**
 		 * @brief Overrides the disconnected callback with the provided function pointer.
 		 * @param callback The function pointer to the disconnected callback.
+		 * @note The callback is passed this Network as its userData.
 		 */
-		void override_disconnected_callback(P2PVoidCallback callback) { p2p_set_disconnected_callback(network, callback); }
+		void override_disconnected_callback(P2PVoidCallback callback) { p2p_set_disconnected_callback(network, callback, this); }
 
-	private:
-		static bool on_mesage_impl(P2PNetwork n, P2PMessage* msg) {
-			Network& network = *networks[n];
-			if(!network.on_message.empty())
-				network.on_message(network, *reinterpret_cast<struct Message*>(msg));
-			return true; // Go should never panic!
-		}
+		/**
+		 * @brief Overrides the error callback with the provided function pointer.
+		 * @param callback The function pointer to the error callback.
+		 * @note The callback is passed this Network as its userData.
+		 */
+		void override_error_callback(P2PErrorCallback callback) { p2p_set_error_callback(network, callback, this); }
 
-		static bool on_peer_connected_impl(P2PNetwork n, char* peerID) {
-			Network& network = *networks[n];
+	private:
+		PeerID localID; // Cached result of p2p_local_id
+		std::vector<P2PMessage> polled; // Reused storage for the messages returned by poll
+		std::vector<P2PEvent> polledEvents; // Reused storage for the events returned by poll_events
+		struct {
+			std::vector<char> buffer;
+			std::vector<int> offsets = std::vector<int>(1);
+			std::vector<PeerID::view> views;
+			P2PTopic topic = -1;
+			long long version = -1;
+		} peerList; // Reused storage for the views returned by peers
+
+		static bool on_message_batch_impl(P2PNetwork, P2PMessage* msgs, int count, void* self); // Defined below Message
+
+		static bool on_peer_connected_impl(P2PNetwork, char* peerID, P2PPeer handle, void* self) {
+			Network& network = *static_cast<Network*>(self);
 			if(!network.on_peer_connected.empty())
-				network.on_peer_connected(network, peerID);
+				network.on_peer_connected(network, peerID, handle);
 			return true; // Go should never panic!
 		}
 
-		static bool on_peer_disconnected_impl(P2PNetwork n, char* peerID) {
-			Network& network = *networks[n];
+		static bool on_peer_disconnected_impl(P2PNetwork, char* peerID, P2PPeer handle, void* self) {
+			Network& network = *static_cast<Network*>(self);
 			if(!network.on_peer_disconnected.empty())
-				network.on_peer_disconnected(network, peerID);
+				network.on_peer_disconnected(network, peerID, handle);
 			return true; // Go should never panic!
 		}
 
-		static bool on_topic_subscribed_impl(P2PNetwork n, P2PTopic topicID) {
-			Network& network = *networks[n];
+		static bool on_topic_subscribed_impl(P2PNetwork, P2PTopic topicID, void* self) {
+			Network& network = *static_cast<Network*>(self);
 			if(!network.on_topic_subscribed.empty())
 				network.on_topic_subscribed(network, {network.network, topicID});
 			return true; // Go should never panic!
 		}
 
-		static bool on_topic_unsubscribed_impl(P2PNetwork n, P2PTopic topicID) {
-			Network& network = *networks[n];
+		static bool on_topic_unsubscribed_impl(P2PNetwork, P2PTopic topicID, void* self) {
+			Network& network = *static_cast<Network*>(self);
 			if(!network.on_topic_unsubscribed.empty())
 				network.on_topic_unsubscribed(network, {network.network, topicID});
 			return true; // Go should never panic!
 		}
 
-		static bool on_connected_impl(P2PNetwork n) {
-			Network& network = *networks[n];
+		static bool on_connected_impl(P2PNetwork, void* self) {
+			Network& network = *static_cast<Network*>(self);
 			if(!network.on_connected.empty())
 				network.on_connected(network);
 			return true; // Go should never panic!
 		}
 
-		static bool on_disconnected_impl(P2PNetwork n) {
-			Network& network = *networks[n];
+		static bool on_disconnected_impl(P2PNetwork, void* self) {
+			Network& network = *static_cast<Network*>(self);
 			if(!network.on_disconnected.empty())
 				network.on_disconnected(network);
 			return true; // Go should never panic!
 		}
+
+		static bool on_error_impl(P2PNetwork, P2PError error, char* description, void* self) {
+			Network& network = *static_cast<Network*>(self);
+			if(!network.on_error.empty())
+				network.on_error(network, error, description);
+			return true; // Go should never panic!
+		}
+	};
+
+	/**
+	 * @brief Options describing a link between two networks inside a Simulation.
+	 */
+	struct LinkOptions {
+		std::chrono::microseconds latency = {}; ///< The time a message takes to cross the link.
+		double bandwidth = 0;                   ///< The bytes per second the link can carry (0 for unlimited).
+		double loss = 0;                        ///< The fraction (0-1) of messages lost crossing the link.
+
+		operator P2PLinkOptions() const { return { std::chrono::duration_cast<std::chrono::duration<double>>(latency).count(), bandwidth, loss }; }
+	};
+
+	/**
+	 * @class Simulation
+	 * @brief Represents an in-process simulated network (backed by libp2p's mocknet) which networks can run inside instead of on real sockets.
+	 * @note The simulation must outlive every network running inside of it!
+	 */
+	class Simulation {
+		P2PSimulation simulation;
+	public:
+		/**
+		 * @brief Constructor that creates the simulation.
+		 * @param defaults The options every link starts with.
+		 * @param seed The seed for the simulation's random choices (initializing the same networks in the same order reproduces the same simulation).
+		 */
+		Simulation(const LinkOptions& defaults = {}, long long seed = 0) : simulation(p2p_create_simulation(defaults, seed)) {}
+
+		/**
+		 * @brief Destructor.
+		 */
+		~Simulation() { p2p_destroy_simulation(simulation); }
+
+		Simulation(const Simulation&) = delete;
+		Simulation& operator=(const Simulation&) = delete;
+
+		/**
+		 * @brief Changes the link between two networks running inside the simulation.
+		 * @param a The network on one end of the link.
+		 * @param b The network on the other end of the link.
+		 * @param options The link's new options.
+		 * @return True if the link was changed, false if either network isn't running inside the simulation.
+		 */
+		bool set_link(const Network& a, const Network& b, const LinkOptions& options) const { return p2p_set_link_options(simulation, a.network, b.network, options); }
+
+		/**
+		 * @brief Discovery options for a network which should run inside the simulation.
+		 * @param targetPeers The number of other networks in the simulation to connect to (0 uses the library's default).
+		 * @return The discovery options.
+		 */
+		DiscoveryOptions discovery(int targetPeers = 0) const { return DiscoveryOptions::simulated(simulation, targetPeers); }
+
+		operator P2PSimulation() const { return simulation; }
+	};
+
+	/**
+	 * @brief Starts writing a pprof CPU profile of the library's Go runtime (every network in the process) to a file.
+	 * @param path The file to write the profile to.
+	 * @return True if profiling started, false if the file couldn't be created or a profile is already running.
+	 */
+	inline bool start_cpu_profile(const std::string& path) { return p2p_start_cpu_profile(path.c_str()); }
+
+	/**
+	 * @brief Stops the running CPU profile and finishes writing it.
+	 * @return True if a profile was stopped and written, false otherwise.
+	 */
+	inline bool stop_cpu_profile() { return p2p_stop_cpu_profile(); }
+
+	/**
+	 * @brief Writes a pprof heap profile of the library's Go runtime to a file.
+	 * @param path The file to write the profile to.
+	 * @return True if the profile was written, false otherwise.
+	 */
+	inline bool write_heap_profile(const std::string& path) { return p2p_write_heap_profile(path.c_str()); }
+
+	/**
+	 * @brief Writes the stacks of every goroutine in the library's Go runtime to a file (in pprof format).
+	 * @param path The file to write the dump to.
+	 * @return True if the dump was written, false otherwise.
+	 */
+	inline bool write_goroutine_dump(const std::string& path) { return p2p_write_goroutine_dump(path.c_str()); }
+
+	/**
+	 * @brief Gets how long calls into the application's callbacks (from every network) have taken, indexed by P2PCallbackKind.
+	 * @param reset Whether to clear the profile afterwards.
+	 * @return The profile, total_time - callback_time is the library's cost of crossing into the callbacks.
+	 */
+	inline P2PCallbackProfile callback_profile(bool reset = false) {
+		P2PCallbackProfile out;
+		p2p_get_callback_profile(&out, reset);
+		return out;
+	}
+
+	/**
+	 * @struct LogRecord
+	 * @brief Represents a log message from the library.
+	 */
+	struct LogRecord: private P2PLogRecord {
+		/**
+		 * @brief Gets the severity of the message.
+		 * @return The message's level.
+		 */
+		P2PLogLevel level() const { return P2PLogRecord::level; }
+
+		/**
+		 * @brief Gets the network the message is about.
+		 * @return The network's ID (-1 if the message isn't about a particular network).
+		 */
+		P2PNetwork network() const { return P2PLogRecord::network; }
+
+		/**
+		 * @brief Gets when the message was logged.
+		 * @return The time the message was logged.
+		 */
+		std::chrono::system_clock::time_point time() const {
+			return std::chrono::system_clock::time_point{std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::duration<double>(P2PLogRecord::time))};
+		}
+
+		/**
+		 * @brief Gets how many identical messages were suppressed since this one was last delivered.
+		 * @return The number of suppressed repeats (0 if this is the message's first delivery).
+		 */
+		unsigned int repeated() const { return P2PLogRecord::repeated; }
+
+		/**
+		 * @brief Gets the message.
+		 * @return The message as a string view.
+		 */
+		std::string_view message() const { return { P2PLogRecord::message, (size_t)message_size }; }
 	};
 
-#ifdef SIMPLE_P2P_IMPLEMENTATION
-	std::map<P2PNetwork, Network*> Network::networks;
-#endif
+	/**
+	 * @brief Function receiving batches of log messages, see set_log_callback().
+	 */
+	using LogCallback = std::function<void(std::span<const LogRecord>)>;
+
+	/**
+	 * @brief Sets the function the library's log messages (from every network) are delivered to (from a background thread, in batches).
+	 * @note Identical messages repeated within a second are suppressed and levels below the given one are never formatted.
+	 * @warning Not thread safe, and must not be called from inside the log callback!
+	 * @param level The lowest level of message to deliver (P2P_LOG_OFF discards every message).
+	 * @param callback The function to deliver messages to (an empty function goes back to printing messages to stdout).
+	 */
+	inline void set_log_callback(P2PLogLevel level, LogCallback callback) {
+		static std::unique_ptr<LogCallback> current; // Kept alive until the library is no longer using it
+		auto next = callback ? std::make_unique<LogCallback>(std::move(callback)) : nullptr;
+		if(next)
+			p2p_set_log_callback(level, [](P2PLogRecord* records, int count, void* self) {
+				(*static_cast<LogCallback*>(self))({ reinterpret_cast<const LogRecord*>(records), (size_t)count });
+			}, next.get());
+		else p2p_set_log_callback(level, nullptr, nullptr);
+		p2p_flush_log(); // Once everything staged has been delivered the previous callback is no longer in use
+		current = std::move(next);
+	}
 
 	/**
 	 * @struct Message
@@ -495,43 +1169,88 @@ namespace p2p {
 	 */
 	struct Message: private P2PMessage {
 		/**
-		 * @brief finds the network originating this message.
-		 * @return a reference to that network.
+		 * @brief Gets the sender of the message.
+		 * @return The sender's ID.
 		 */
-		Network& lookup_network() { return *Network::networks[P2PMessage::network];}
+		PeerID::view sender() const { return { received_from, (size_t)received_from_size }; }
 
 		/**
-		 * @brief Gets the sender of the message.
-		 * @return The sender's ID.
+		 * @brief Gets the handle of the sender of the message.
+		 * @note Handles are dense (and never reused while the network is running) so they can index flat arrays of per peer state.
+		 * @return The sender's handle.
 		 */
-		PeerID::view sender() { return received_from; }
+		P2PPeer sender_handle() const { return received_from_handle; }
 
 		/**
 		 * @brief Gets the message data as a string view.
+		 * @note The view covers the whole payload, including any embedded nulls.
 		 * @return The message data as a string view.
 		 */
-		std::string_view data_string() { return P2PMessage::data; }
+		std::string_view data_string() const { return { P2PMessage::data, (size_t)data_size }; }
 
 		/**
 		 * @brief Gets the message data as a byte span.
 		 * @return The message data as a byte span.
 		 */
-		std::span<std::byte> data() { auto view = data_string(); return { (std::byte*)view.data(), view.size() }; }
+		std::span<const std::byte> data() const { return { (const std::byte*)P2PMessage::data, (size_t)data_size }; }
+
+		/**
+		 * @brief Gets the sequence number of the message.
+		 * @return The raw bytes of the sequence number.
+		 */
+		std::span<const std::byte> seqno() const { return { (const std::byte*)P2PMessage::seqno, (size_t)seqno_size }; }
+
+		/**
+		 * @brief Gets the signature of the message.
+		 * @return The raw bytes of the signature.
+		 */
+		std::span<const std::byte> signature() const { return { (const std::byte*)P2PMessage::signature, (size_t)signature_size }; }
+
+		/**
+		 * @brief Gets the key of the message.
+		 * @return The raw bytes of the key.
+		 */
+		std::span<const std::byte> key() const { return { (const std::byte*)P2PMessage::key, (size_t)key_size }; }
+
+		/**
+		 * @brief Gets the ID of the message.
+		 * @return The message's ID.
+		 */
+		std::string_view id() const { return { P2PMessage::id, (size_t)id_size }; }
 
 		/**
 		 * @brief Checks if the message was sent by the local node.
-		 * @param network (optional) the network this message originated from (avoids a map lookup if provided)
+		 * @deprecated The library now flags local messages itself, use is_local() instead.
 		 * @return True if the message was sent by the local node, false otherwise.
 		 */
-		bool is_local(const Network& network) { return network.local_id() == sender(); }
+		[[deprecated("The network is no longer needed, use is_local() instead")]]
+		bool is_local(const Network&) const { return is_local(); }
 
 		/**
 		 * @brief Checks if the message was sent by the local node.
 		 * @return True if the message was sent by the local node, false otherwise.
 		 */
-		bool is_local() { return is_local(lookup_network()); }
+		bool is_local() const { return local; }
 
 	};
+
+	inline std::span<Message> Network::poll(size_t max) {
+		polled.resize(max);
+		int count = p2p_poll_messages(network, polled.data(), max);
+		if(count <= 0) return {};
+		return {reinterpret_cast<Message*>(polled.data()), (size_t)count};
+	}
+
+	inline bool Network::on_message_batch_impl(P2PNetwork, P2PMessage* msgs, int count, void* self) {
+		Network& network = *static_cast<Network*>(self);
+		std::span<Message> batch = {reinterpret_cast<Message*>(msgs), (size_t)count};
+		if(!network.on_message_batch.empty())
+			network.on_message_batch(network, batch);
+		if(!network.on_message.empty())
+			for(auto& msg: batch)
+				network.on_message(network, msg);
+		return true; // Go should never panic!
+	}
 }
 
 #endif // SIMPLE_P2P_NETWORKING_HPP